@@ -8413,32 +8413,52 @@ BlockDriverState *bdrv_backing_chain_next(BlockDriverState *bs)
 }
 
 /**
- * Check whether [offset, offset + bytes) overlaps with the cached
+ * Check whether [offset, offset + bytes) overlaps with the given cached
  * block-status data region.
  *
- * If so, and @pnum is not NULL, set *pnum to `bsc.data_end - offset`,
+ * If so, and @pnum is not NULL, set *pnum to `data_end - offset`,
  * which is what bdrv_bsc_is_data()'s interface needs.
  * Otherwise, *pnum is not touched.
  */
-static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
-                                           int64_t offset, int64_t bytes,
-                                           int64_t *pnum)
+static bool bdrv_bsc_extent_overlaps(BdrvBlockStatusCacheExtent *extent,
+                                     int64_t offset, int64_t bytes,
+                                     int64_t *pnum)
 {
-    BdrvBlockStatusCache *bsc = qatomic_rcu_read(&bs->block_status_cache);
     bool overlaps;
 
     overlaps =
-        qatomic_read(&bsc->valid) &&
-        ranges_overlap(offset, bytes, bsc->data_start,
-                       bsc->data_end - bsc->data_start);
+        qatomic_read(&extent->valid) &&
+        ranges_overlap(offset, bytes, extent->data_start,
+                       extent->data_end - extent->data_start);
 
     if (overlaps && pnum) {
-        *pnum = bsc->data_end - offset;
+        *pnum = extent->data_end - offset;
     }
 
     return overlaps;
 }
 
+/**
+ * Check whether [offset, offset + bytes) overlaps with any of the cached
+ * block-status data regions.  See bdrv_bsc_extent_overlaps() for @pnum.
+ */
+static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
+                                           int64_t offset, int64_t bytes,
+                                           int64_t *pnum)
+{
+    BdrvBlockStatusCache *bsc = qatomic_rcu_read(&bs->block_status_cache);
+    int i;
+
+    /* Search from the newest entry, it is the most likely one to match */
+    for (i = bsc->nb_extents - 1; i >= 0; i--) {
+        if (bdrv_bsc_extent_overlaps(&bsc->extents[i], offset, bytes, pnum)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /**
  * See block_int.h for this function's documentation.
  */
@@ -8455,11 +8475,27 @@ bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes)
 {
+    BdrvBlockStatusCache *bsc;
+    int i;
+
     IO_CODE();
     RCU_READ_LOCK_GUARD();
 
-    if (bdrv_bsc_range_overlaps_locked(bs, offset, bytes, NULL)) {
-        qatomic_set(&bs->block_status_cache->valid, false);
+    if (!bdrv_bsc_range_overlaps_locked(bs, offset, bytes, NULL)) {
+        return;
+    }
+
+    /*
+     * Take the lock so that a concurrent bdrv_bsc_fill() cannot copy an
+     * entry into its new cache right before we invalidate it in the old one
+     */
+    QEMU_LOCK_GUARD(&bs->bsc_modify_lock);
+
+    bsc = qatomic_rcu_read(&bs->block_status_cache);
+    for (i = 0; i < bsc->nb_extents; i++) {
+        if (bdrv_bsc_extent_overlaps(&bsc->extents[i], offset, bytes, NULL)) {
+            qatomic_set(&bsc->extents[i].valid, false);
+        }
     }
 }
 
@@ -8468,19 +8504,46 @@ void bdrv_bsc_invalidate_range(BlockDriverState *bs,
  */
 void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
 {
-    BdrvBlockStatusCache *new_bsc = g_new(BdrvBlockStatusCache, 1);
+    BdrvBlockStatusCache *new_bsc = g_new0(BdrvBlockStatusCache, 1);
     BdrvBlockStatusCache *old_bsc;
+    int64_t start = offset;
+    int64_t end = offset + bytes;
+    int i;
     IO_CODE();
 
-    *new_bsc = (BdrvBlockStatusCache) {
-        .valid = true,
-        .data_start = offset,
-        .data_end = offset + bytes,
-    };
-
     QEMU_LOCK_GUARD(&bs->bsc_modify_lock);
 
     old_bsc = qatomic_rcu_read(&bs->block_status_cache);
+
+    /*
+     * Keep the old entries (oldest first), except for those that overlap
+     * with or are adjacent to the new region, which are merged into it
+     */
+    for (i = 0; i < old_bsc->nb_extents; i++) {
+        BdrvBlockStatusCacheExtent *extent = &old_bsc->extents[i];
+
+        if (!qatomic_read(&extent->valid)) {
+            continue;
+        }
+        if (extent->data_end >= start && extent->data_start <= end) {
+            start = MIN(start, extent->data_start);
+            end = MAX(end, extent->data_end);
+            continue;
+        }
+        new_bsc->extents[new_bsc->nb_extents++] = *extent;
+    }
+
+    if (new_bsc->nb_extents == BDRV_BSC_MAX_EXTENTS) {
+        new_bsc->nb_extents--;
+        memmove(&new_bsc->extents[0], &new_bsc->extents[1],
+                new_bsc->nb_extents * sizeof(new_bsc->extents[0]));
+    }
+    new_bsc->extents[new_bsc->nb_extents++] = (BdrvBlockStatusCacheExtent) {
+        .valid = true,
+        .data_start = start,
+        .data_end = end,
+    };
+
     qatomic_rcu_set(&bs->block_status_cache, new_bsc);
     if (old_bsc) {
         g_free_rcu(old_bsc, rcu);
@@ -0,0 +1,225 @@
+/*
+ * query-stats support for the Linux AIO engines
+ *
+ * Copyright (c) 2025 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/aio.h"
+#include "block/raw-aio.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "qom/object.h"
+#include "system/iothread.h"
+#include "system/stats.h"
+
+typedef struct AioEngineStatsArgs {
+    StatsResultList **result;
+    StatsProvider provider;
+    strList *names;
+} AioEngineStatsArgs;
+
+static AioEngineStats *aio_engine_stats_get(AioContext *ctx,
+                                            StatsProvider provider)
+{
+    switch (provider) {
+#ifdef CONFIG_LINUX_AIO
+    case STATS_PROVIDER_LINUX_AIO: {
+        LinuxAioState *s = qatomic_read(&ctx->linux_aio);
+        return s ? laio_get_stats(s) : NULL;
+    }
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    case STATS_PROVIDER_IO_URING: {
+        LuringState *s = qatomic_read(&ctx->linux_io_uring);
+        return s ? luring_get_stats(s) : NULL;
+    }
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static StatsList *aio_engine_stats_add_scalar(StatsList *list,
+                                              const char *name,
+                                              const Stat64 *value)
+{
+    Stats *stats = g_new0(Stats, 1);
+
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = stat64_get(value);
+
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static StatsList *aio_engine_stats_add_hist(StatsList *list, const char *name,
+                                            const Stat64 *buckets,
+                                            unsigned int nr_buckets)
+{
+    Stats *stats = g_new0(Stats, 1);
+    uint64List *hist = NULL;
+    int i;
+
+    for (i = nr_buckets - 1; i >= 0; i--) {
+        QAPI_LIST_PREPEND(hist, stat64_get(&buckets[i]));
+    }
+
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QLIST;
+    stats->value->u.list = hist;
+
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+/* Must list the statistics in the same order as aio_engine_schemas_add() */
+static void aio_engine_stats_add(AioEngineStatsArgs *args, AioContext *ctx,
+                                 const char *qom_path)
+{
+    AioEngineStats *s = aio_engine_stats_get(ctx, args->provider);
+    StatsList *list = NULL;
+
+    if (!s) {
+        return;
+    }
+
+    if (apply_str_list_filter("requests", args->names)) {
+        list = aio_engine_stats_add_scalar(list, "requests", &s->requests);
+    }
+    if (apply_str_list_filter("submissions", args->names)) {
+        list = aio_engine_stats_add_scalar(list, "submissions",
+                                           &s->submissions);
+    }
+    if (apply_str_list_filter("batch-limit", args->names)) {
+        list = aio_engine_stats_add_scalar(list, "batch-limit",
+                                           &s->batch_limit);
+    }
+    if (apply_str_list_filter("batch-size", args->names)) {
+        list = aio_engine_stats_add_hist(list, "batch-size", s->batch_size,
+                                         AIO_ENGINE_BATCH_BUCKETS);
+    }
+    if (apply_str_list_filter("latency", args->names)) {
+        list = aio_engine_stats_add_hist(list, "latency", s->latency,
+                                         AIO_ENGINE_LATENCY_BUCKETS);
+    }
+
+    if (list) {
+        add_stats_entry(args->result, args->provider, qom_path, list);
+    }
+}
+
+static int aio_engine_stats_iothread(Object *obj, void *opaque)
+{
+    AioEngineStatsArgs *args = opaque;
+    g_autofree char *qom_path = NULL;
+    AioContext *ctx;
+
+    if (!object_dynamic_cast(obj, TYPE_IOTHREAD)) {
+        return 0;
+    }
+
+    ctx = iothread_get_aio_context(IOTHREAD(obj));
+    if (ctx) {
+        qom_path = object_get_canonical_path(obj);
+        aio_engine_stats_add(args, ctx, qom_path);
+    }
+    return 0;
+}
+
+static void aio_engine_stats_query(StatsResultList **result,
+                                   StatsProvider provider, StatsTarget target,
+                                   strList *names)
+{
+    AioEngineStatsArgs args = {
+        .result = result,
+        .provider = provider,
+        .names = names,
+    };
+
+    if (target != STATS_TARGET_IOTHREAD) {
+        return;
+    }
+
+    aio_engine_stats_add(&args, qemu_get_aio_context(), NULL);
+    object_child_foreach(object_get_objects_root(),
+                         aio_engine_stats_iothread, &args);
+}
+
+static StatsSchemaValueList *aio_engine_schema_add(StatsSchemaValueList *list,
+                                                   const char *name,
+                                                   StatsType type)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void aio_engine_schemas_add(StatsSchemaList **result,
+                                   StatsProvider provider)
+{
+    StatsSchemaValueList *list = NULL;
+
+    list = aio_engine_schema_add(list, "requests", STATS_TYPE_CUMULATIVE);
+    list = aio_engine_schema_add(list, "submissions", STATS_TYPE_CUMULATIVE);
+    list = aio_engine_schema_add(list, "batch-limit", STATS_TYPE_INSTANT);
+    list = aio_engine_schema_add(list, "batch-size",
+                                 STATS_TYPE_LOG2_HISTOGRAM);
+    list = aio_engine_schema_add(list, "latency", STATS_TYPE_LOG2_HISTOGRAM);
+    list->value->has_unit = true;
+    list->value->unit = STATS_UNIT_SECONDS;
+    list->value->has_base = true;
+    list->value->base = 10;
+    list->value->exponent = -6;
+
+    add_stats_schema(result, provider, STATS_TARGET_IOTHREAD, list);
+}
+
+#ifdef CONFIG_LINUX_AIO
+static void laio_stats_cb(StatsResultList **result, StatsTarget target,
+                          strList *names, strList *targets, Error **errp)
+{
+    aio_engine_stats_query(result, STATS_PROVIDER_LINUX_AIO, target, names);
+}
+
+static void laio_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    aio_engine_schemas_add(result, STATS_PROVIDER_LINUX_AIO);
+}
+#endif
+
+#ifdef CONFIG_LINUX_IO_URING
+static void luring_stats_cb(StatsResultList **result, StatsTarget target,
+                            strList *names, strList *targets, Error **errp)
+{
+    aio_engine_stats_query(result, STATS_PROVIDER_IO_URING, target, names);
+}
+
+static void luring_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    aio_engine_schemas_add(result, STATS_PROVIDER_IO_URING);
+}
+#endif
+
+static void aio_engine_stats_init(void)
+{
+#ifdef CONFIG_LINUX_AIO
+    add_stats_callbacks(STATS_PROVIDER_LINUX_AIO, laio_stats_cb,
+                        laio_schemas_cb);
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    add_stats_callbacks(STATS_PROVIDER_IO_URING, luring_stats_cb,
+                        luring_schemas_cb);
+#endif
+}
+
+block_init(aio_engine_stats_init);
@@ -25,6 +25,7 @@
 #include "qemu/co-shared-resource.h"
 #include "qemu/coroutine.h"
 #include "qemu/ratelimit.h"
+#include "qemu/stats64.h"
 #include "block/aio_task.h"
 #include "qemu/error-report.h"
 #include "qemu/memalign.h"
@@ -35,6 +36,9 @@
 #define BLOCK_COPY_MAX_WORKERS 64
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
 #define BLOCK_COPY_CLUSTER_SIZE_DEFAULT (1 << 16)
+#define BLOCK_COPY_PREFETCH_EXTENTS 32
+#define BLOCK_COPY_MAX_PREFETCH_CHUNK (16 * MiB)
+#define BLOCK_COPY_THROUGHPUT_SLICE_NS NANOSECONDS_PER_SECOND
 
 typedef enum {
     COPY_READ_WRITE_CLUSTER,
@@ -53,6 +57,7 @@ typedef struct BlockCopyCallState {
     int64_t bytes;
     int max_workers;
     int64_t max_chunk;
+    bool prefetch;
     bool ignore_ratelimit;
     BlockCopyAsyncCallbackFunc cb;
     void *cb_opaque;
@@ -140,6 +145,9 @@ typedef struct BlockCopyState {
     bool discard_source;
     BlockReqList reqs;
     QLIST_HEAD(, BlockCopyCallState) calls;
+    /* Bytes copied since throughput_slice_start_ns */
+    int64_t throughput_slice_start_ns;
+    uint64_t throughput_slice_bytes;
     /*
      * skip_unallocated:
      *
@@ -160,6 +168,8 @@ typedef struct BlockCopyState {
     ProgressMeter *progress;
     SharedResource *mem;
     RateLimit rate_limit;
+    /* Bytes per second copied in the previous throughput slice */
+    Stat64 throughput;
 } BlockCopyState;
 
 /* Called with lock held */
@@ -184,16 +194,21 @@ static int64_t block_copy_chunk_size(BlockCopyState *s)
 /*
  * Search for the first dirty area in offset/bytes range and create task at
  * the beginning of it.
+ *
+ * @max_chunk overrides the default chunk size for the current copy method if
+ * non-zero.
  */
 static coroutine_fn BlockCopyTask *
 block_copy_task_create(BlockCopyState *s, BlockCopyCallState *call_state,
-                       int64_t offset, int64_t bytes)
+                       int64_t offset, int64_t bytes, int64_t max_chunk)
 {
     BlockCopyTask *task;
-    int64_t max_chunk;
 
     QEMU_LOCK_GUARD(&s->lock);
-    max_chunk = MIN_NON_ZERO(block_copy_chunk_size(s), call_state->max_chunk);
+    if (!max_chunk) {
+        max_chunk = MIN_NON_ZERO(block_copy_chunk_size(s),
+                                 call_state->max_chunk);
+    }
     if (!bdrv_dirty_bitmap_next_dirty_area(s->copy_bitmap,
                                            offset, offset + bytes,
                                            max_chunk, &offset, &bytes))
@@ -431,6 +446,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
         .len = bdrv_dirty_bitmap_size(copy_bitmap),
         .write_flags = (is_fleecing ? BDRV_REQ_SERIALISING : 0),
         .mem = shres_create(BLOCK_COPY_MAX_MEM),
+        .throughput_slice_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME),
         .max_transfer = QEMU_ALIGN_DOWN(
                                     block_copy_max_transfer(source, target),
                                     cluster_size),
@@ -578,6 +594,22 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
     return ret;
 }
 
+/* Called with lock held */
+static void block_copy_account_throughput(BlockCopyState *s, int64_t bytes)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - s->throughput_slice_start_ns;
+
+    s->throughput_slice_bytes += bytes;
+    if (elapsed >= BLOCK_COPY_THROUGHPUT_SLICE_NS) {
+        stat64_set(&s->throughput,
+                   muldiv64(s->throughput_slice_bytes,
+                            NANOSECONDS_PER_SECOND, elapsed));
+        s->throughput_slice_start_ns = now;
+        s->throughput_slice_bytes = 0;
+    }
+}
+
 static coroutine_fn int block_copy_task_entry(AioTask *task)
 {
     BlockCopyTask *t = container_of(task, BlockCopyTask, task);
@@ -601,8 +633,11 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
                 t->call_state->ret = ret;
                 t->call_state->error_is_read = error_is_read;
             }
-        } else if (s->progress) {
-            progress_work_done(s->progress, t->req.bytes);
+        } else {
+            block_copy_account_throughput(s, t->req.bytes);
+            if (s->progress) {
+                progress_work_done(s->progress, t->req.bytes);
+            }
         }
     }
     co_put_to_shres(s->mem, t->req.bytes);
@@ -736,6 +771,64 @@ int64_t coroutine_fn block_copy_reset_unallocated(BlockCopyState *s,
     return ret;
 }
 
+/*
+ * block_copy_prefetch
+ *
+ * Look ahead for up to BLOCK_COPY_PREFETCH_EXTENTS dirty extents in the
+ * @offset/@bytes range and pick a chunk size that spreads the dirty data in
+ * them over all workers of @call_state.  Small extents are still copied with
+ * one request each, large ones are split into requests that are larger than
+ * the default chunk size if there are fewer extents than workers.
+ *
+ * Returns the chunk size to use up to *@window_end, or 0 if there is nothing
+ * dirty in the range.
+ */
+static int64_t coroutine_fn
+block_copy_prefetch(BlockCopyState *s, BlockCopyCallState *call_state,
+                    int64_t offset, int64_t bytes, int64_t *window_end)
+{
+    int64_t start = offset, end = offset + bytes;
+    int64_t dirty_bytes = 0;
+    int64_t chunk, min_chunk, max_chunk;
+    int64_t dirty_offset, dirty_count;
+    int extents = 0;
+
+    QEMU_LOCK_GUARD(&s->lock);
+
+    while (extents < BLOCK_COPY_PREFETCH_EXTENTS && offset < end &&
+           bdrv_dirty_bitmap_next_dirty_area(s->copy_bitmap, offset, end,
+                                             INT64_MAX, &dirty_offset,
+                                             &dirty_count))
+    {
+        dirty_bytes += dirty_count;
+        offset = dirty_offset + dirty_count;
+        extents++;
+    }
+
+    if (!extents) {
+        return 0;
+    }
+    *window_end = QEMU_ALIGN_UP(offset, s->cluster_size);
+
+    min_chunk = block_copy_chunk_size(s);
+    if (s->method == COPY_READ_WRITE_CLUSTER) {
+        /* Compressed writes and small max_transfer need single clusters */
+        max_chunk = min_chunk;
+    } else {
+        max_chunk = MIN(MAX(min_chunk, BLOCK_COPY_MAX_PREFETCH_CHUNK),
+                        s->max_transfer);
+    }
+    max_chunk = MIN_NON_ZERO(max_chunk, call_state->max_chunk);
+
+    chunk = DIV_ROUND_UP(dirty_bytes, call_state->max_workers);
+    chunk = QEMU_ALIGN_UP(chunk, s->cluster_size);
+    chunk = MIN(MAX(chunk, min_chunk), max_chunk);
+
+    trace_block_copy_prefetch(s, start, *window_end, extents, dirty_bytes,
+                              chunk);
+    return chunk;
+}
+
 /*
  * block_copy_dirty_clusters
  *
@@ -753,6 +846,8 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
     int ret = 0;
     bool found_dirty = false;
     int64_t end = offset + bytes;
+    int64_t window_end = call_state->prefetch ? offset : end;
+    int64_t max_chunk = 0;
     AioTaskPool *aio = NULL;
 
     /*
@@ -770,7 +865,27 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         BlockCopyTask *task;
         int64_t status_bytes;
 
-        task = block_copy_task_create(s, call_state, offset, bytes);
+        if (call_state->prefetch && offset >= window_end) {
+            max_chunk = block_copy_prefetch(s, call_state, offset, bytes,
+                                            &window_end);
+            if (!max_chunk) {
+                trace_block_copy_skip_range(s, offset, bytes);
+                break;
+            }
+            if (!aio) {
+                aio = aio_task_pool_new(call_state->max_workers);
+            }
+        }
+
+        task = block_copy_task_create(s, call_state, offset,
+                                      MIN(bytes, window_end - offset),
+                                      max_chunk);
+        if (!task && window_end < end) {
+            /* Somebody else copied the rest of the window, scan further */
+            offset = window_end;
+            bytes = end - offset;
+            continue;
+        }
         if (!task) {
             /* No more dirty bits in the bitmap */
             trace_block_copy_skip_range(s, offset, bytes);
@@ -972,6 +1087,7 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t start, int64_t bytes,
 BlockCopyCallState *block_copy_async(BlockCopyState *s,
                                      int64_t offset, int64_t bytes,
                                      int max_workers, int64_t max_chunk,
+                                     bool prefetch,
                                      BlockCopyAsyncCallbackFunc cb,
                                      void *cb_opaque)
 {
@@ -983,6 +1099,7 @@ BlockCopyCallState *block_copy_async(BlockCopyState *s,
         .bytes = bytes,
         .max_workers = max_workers,
         .max_chunk = max_chunk,
+        .prefetch = prefetch,
         .cb = cb,
         .cb_opaque = cb_opaque,
 
@@ -1062,6 +1179,11 @@ void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
     qatomic_set(&s->skip_unallocated, skip);
 }
 
+uint64_t block_copy_throughput(BlockCopyState *s)
+{
+    return stat64_get(&s->throughput);
+}
+
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed)
 {
     ratelimit_set_speed(&s->rate_limit, speed, BLOCK_COPY_SLICE_TIME);
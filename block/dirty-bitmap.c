@@ -64,10 +64,18 @@ struct BdrvDirtyBitmapIter {
 static inline void bdrv_dirty_bitmaps_lock(BlockDriverState *bs)
 {
     qemu_mutex_lock(&bs->dirty_bitmap_mutex);
+
+    qatomic_set(&bs->dirty_bitmap_exclusive, true);
+    /* Pairs with smp_mb__after_rmw() in bdrv_set_dirty() */
+    smp_mb();
+    while (qatomic_read(&bs->dirty_bitmap_setters)) {
+        cpu_relax();
+    }
 }
 
 static inline void bdrv_dirty_bitmaps_unlock(BlockDriverState *bs)
 {
+    qatomic_store_release(&bs->dirty_bitmap_exclusive, false);
     qemu_mutex_unlock(&bs->dirty_bitmap_mutex);
 }
 
@@ -95,11 +103,16 @@ BdrvDirtyBitmap *bdrv_find_dirty_bitmap(BlockDriverState *bs, const char *name)
     return NULL;
 }
 
-/* Called with BQL taken.  */
-BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs,
-                                          uint32_t granularity,
-                                          const char *name,
-                                          Error **errp)
+/*
+ * Like bdrv_create_dirty_bitmap(), but if @sparse is true, the bitmap only
+ * allocates memory for the regions that are dirty.
+ * Called with BQL taken.
+ */
+BdrvDirtyBitmap *bdrv_create_dirty_bitmap_full(BlockDriverState *bs,
+                                               uint32_t granularity,
+                                               const char *name,
+                                               bool sparse,
+                                               Error **errp)
 {
     int64_t bitmap_size;
     BdrvDirtyBitmap *bitmap;
@@ -124,7 +137,9 @@ BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs,
     }
     bitmap = g_new0(BdrvDirtyBitmap, 1);
     bitmap->bs = bs;
-    bitmap->bitmap = hbitmap_alloc(bitmap_size, ctz32(granularity));
+    bitmap->bitmap = sparse
+        ? hbitmap_alloc_sparse(bitmap_size, ctz32(granularity))
+        : hbitmap_alloc(bitmap_size, ctz32(granularity));
     bitmap->size = bitmap_size;
     bitmap->name = g_strdup(name);
     bitmap->disabled = false;
@@ -134,6 +149,15 @@ BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs,
     return bitmap;
 }
 
+/* Called with BQL taken.  */
+BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs,
+                                          uint32_t granularity,
+                                          const char *name,
+                                          Error **errp)
+{
+    return bdrv_create_dirty_bitmap_full(bs, granularity, name, false, errp);
+}
+
 int64_t bdrv_dirty_bitmap_size(const BdrvDirtyBitmap *bitmap)
 {
     return bitmap->size;
@@ -202,6 +226,16 @@ int bdrv_dirty_bitmap_check(const BdrvDirtyBitmap *bitmap, uint32_t flags,
     return 0;
 }
 
+/* Allocate an HBitmap of the same kind as @hb */
+static HBitmap *bdrv_dirty_bitmap_alloc_hbitmap(const HBitmap *hb,
+                                                uint64_t size)
+{
+    if (hbitmap_is_sparse(hb)) {
+        return hbitmap_alloc_sparse(size, hbitmap_granularity(hb));
+    }
+    return hbitmap_alloc(size, hbitmap_granularity(hb));
+}
+
 /**
  * Create a successor bitmap destined to replace this bitmap after an operation.
  * Requires that the bitmap is not marked busy and has no successor.
@@ -224,7 +258,9 @@ int bdrv_dirty_bitmap_create_successor(BdrvDirtyBitmap *bitmap, Error **errp)
 
     /* Create an anonymous successor */
     granularity = bdrv_dirty_bitmap_granularity(bitmap);
-    child = bdrv_create_dirty_bitmap(bitmap->bs, granularity, NULL, errp);
+    child = bdrv_create_dirty_bitmap_full(bitmap->bs, granularity, NULL,
+                                          bdrv_dirty_bitmap_sparse(bitmap),
+                                          errp);
     if (!child) {
         return -1;
     }
@@ -580,8 +616,7 @@ void bdrv_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap **out)
         hbitmap_reset_all(bitmap->bitmap);
     } else {
         HBitmap *backup = bitmap->bitmap;
-        bitmap->bitmap = hbitmap_alloc(bitmap->size,
-                                       hbitmap_granularity(backup));
+        bitmap->bitmap = bdrv_dirty_bitmap_alloc_hbitmap(backup, bitmap->size);
         *out = backup;
     }
     bdrv_dirty_bitmaps_unlock(bitmap->bs);
@@ -662,6 +697,29 @@ void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes)
         return;
     }
 
+#if HOST_LONG_BITS == 64
+    /*
+     * Setting bits only ever adds to the bitmaps, so concurrent writers can
+     * use atomic updates and do not need to exclude each other; they only
+     * need to exclude everybody else, who holds the mutex.
+     */
+    qatomic_inc(&bs->dirty_bitmap_setters);
+    /* Pairs with smp_mb() in bdrv_dirty_bitmaps_lock() */
+    smp_mb__after_rmw();
+    if (!qatomic_read(&bs->dirty_bitmap_exclusive)) {
+        QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+            if (!bdrv_dirty_bitmap_enabled(bitmap)) {
+                continue;
+            }
+            assert(!bdrv_dirty_bitmap_readonly(bitmap));
+            hbitmap_set_atomic(bitmap->bitmap, offset, bytes);
+        }
+        qatomic_dec(&bs->dirty_bitmap_setters);
+        return;
+    }
+    qatomic_dec(&bs->dirty_bitmap_setters);
+#endif
+
     bdrv_dirty_bitmaps_lock(bs);
     QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
         if (!bdrv_dirty_bitmap_enabled(bitmap)) {
@@ -732,6 +790,11 @@ void bdrv_dirty_bitmap_set_persistence(BdrvDirtyBitmap *bitmap, bool persistent)
     bdrv_dirty_bitmaps_unlock(bitmap->bs);
 }
 
+bool bdrv_dirty_bitmap_sparse(BdrvDirtyBitmap *bitmap)
+{
+    return hbitmap_is_sparse(bitmap->bitmap);
+}
+
 /* Called with BQL taken. */
 void bdrv_dirty_bitmap_set_inconsistent(BdrvDirtyBitmap *bitmap)
 {
@@ -875,7 +938,7 @@ void bdrv_dirty_bitmap_merge_internal(BdrvDirtyBitmap *dest,
 
     if (backup) {
         *backup = dest->bitmap;
-        dest->bitmap = hbitmap_alloc(dest->size, hbitmap_granularity(*backup));
+        dest->bitmap = bdrv_dirty_bitmap_alloc_hbitmap(*backup, dest->size);
         hbitmap_merge(*backup, src->bitmap, dest->bitmap);
     } else {
         hbitmap_merge(dest->bitmap, src->bitmap, dest->bitmap);
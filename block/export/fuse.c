@@ -29,6 +29,7 @@
 #include "qapi/qapi-commands-block.h"
 #include "qemu/main-loop.h"
 #include "system/block-backend.h"
+#include "system/iothread.h"
 
 #include <fuse.h>
 #include <fuse_lowlevel.h>
@@ -62,8 +63,31 @@ typedef struct FuseExport {
     mode_t st_mode;
     uid_t st_uid;
     gid_t st_gid;
+
+    /*
+     * AioContexts in which read, write and flush requests are processed,
+     * round-robin.  If empty, they are processed in exp->common.ctx.
+     */
+    AioContext **request_ctxs;
+    unsigned int num_request_ctxs;
+    unsigned int next_request_ctx; /* atomic */
 } FuseExport;
 
+/*
+ * A read, write or flush request that is processed in a coroutine, so that
+ * the export can keep receiving requests while it is in flight.
+ */
+typedef struct FuseRequest {
+    FuseExport *exp;
+    fuse_req_t req;
+    int64_t offset;
+    size_t size;
+    /* Write data, points into @buf_mem */
+    const char *buf;
+    /* Receive buffer taken over from the export, freed with the request */
+    void *buf_mem;
+} FuseRequest;
+
 static GHashTable *exports;
 static const struct fuse_lowlevel_ops fuse_ops;
 
@@ -191,6 +215,27 @@ static int fuse_export_create(BlockExport *blk_exp,
     exp->st_uid = getuid();
     exp->st_gid = getgid();
 
+    if (args->has_iothreads) {
+        strList *node;
+        unsigned int i = 0;
+
+        for (node = args->iothreads; node; node = node->next) {
+            exp->num_request_ctxs++;
+        }
+        exp->request_ctxs = g_new(AioContext *, exp->num_request_ctxs);
+
+        for (node = args->iothreads; node; node = node->next) {
+            IOThread *iothread = iothread_by_id(node->value);
+
+            if (!iothread) {
+                error_setg(errp, "iothread \"%s\" not found", node->value);
+                ret = -EINVAL;
+                goto fail;
+            }
+            exp->request_ctxs[i++] = iothread_get_aio_context(iothread);
+        }
+    }
+
     if (args->allow_other == FUSE_EXPORT_ALLOW_OTHER_AUTO) {
         /* Ignore errors on our first attempt */
         ret = setup_fuse_export(exp, args->mountpoint, true, NULL);
@@ -349,6 +394,7 @@ static void fuse_export_delete(BlockExport *blk_exp)
 
     free(exp->fuse_buf.mem);
     g_free(exp->mountpoint);
+    g_free(exp->request_ctxs);
 }
 
 /**
@@ -570,6 +616,91 @@ static void fuse_open(fuse_req_t req, fuse_ino_t inode,
     fuse_reply_open(req, fi);
 }
 
+/**
+ * Run @entry for @r in a coroutine in the next request AioContext.  The
+ * coroutine must call fuse_request_done() when it has replied.
+ */
+static void fuse_dispatch_request(FuseRequest *r, CoroutineEntry *entry)
+{
+    FuseExport *exp = r->exp;
+    AioContext *ctx = exp->common.ctx;
+    Coroutine *co;
+
+    if (exp->num_request_ctxs) {
+        unsigned int i = qatomic_fetch_inc(&exp->next_request_ctx);
+        ctx = exp->request_ctxs[i % exp->num_request_ctxs];
+    }
+
+    blk_exp_ref(&exp->common);
+    qatomic_inc(&exp->in_flight);
+
+    co = qemu_coroutine_create(entry, r);
+    aio_co_enter(ctx, co);
+}
+
+static void fuse_request_done(FuseRequest *r)
+{
+    FuseExport *exp = r->exp;
+
+    free(r->buf_mem);
+    g_free(r);
+
+    if (qatomic_fetch_dec(&exp->in_flight) == 1) {
+        aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
+    }
+    blk_exp_unref(&exp->common);
+}
+
+static void coroutine_fn fuse_co_read_entry(void *opaque)
+{
+    FuseRequest *r = opaque;
+    void *buf;
+    int ret;
+
+    buf = qemu_try_blockalign(blk_bs(r->exp->common.blk), r->size);
+    if (!buf) {
+        fuse_reply_err(r->req, ENOMEM);
+        fuse_request_done(r);
+        return;
+    }
+
+    ret = blk_co_pread(r->exp->common.blk, r->offset, r->size, buf, 0);
+    if (ret >= 0) {
+        fuse_reply_buf(r->req, buf, r->size);
+    } else {
+        fuse_reply_err(r->req, -ret);
+    }
+
+    qemu_vfree(buf);
+    fuse_request_done(r);
+}
+
+static void coroutine_fn fuse_co_write_entry(void *opaque)
+{
+    FuseRequest *r = opaque;
+    int ret;
+
+    ret = blk_co_pwrite(r->exp->common.blk, r->offset, r->size, r->buf, 0);
+    if (ret >= 0) {
+        fuse_reply_write(r->req, r->size);
+    } else {
+        fuse_reply_err(r->req, -ret);
+    }
+
+    fuse_request_done(r);
+}
+
+static void coroutine_fn fuse_co_flush_entry(void *opaque)
+{
+    FuseRequest *r = opaque;
+    int ret;
+
+    ret = blk_co_flush(r->exp->common.blk);
+    fuse_reply_err(r->req, ret < 0 ? -ret : 0);
+
+    fuse_request_done(r);
+}
+
 /**
  * Handle client reads from the exported image.
  */
@@ -577,9 +708,8 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
                       size_t size, off_t offset, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
+    FuseRequest *r;
     int64_t length;
-    void *buf;
-    int ret;
 
     /* Limited by max_read, should not happen */
     if (size > FUSE_MAX_BOUNCE_BYTES) {
@@ -601,20 +731,14 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
         size = length - offset;
     }
 
-    buf = qemu_try_blockalign(blk_bs(exp->common.blk), size);
-    if (!buf) {
-        fuse_reply_err(req, ENOMEM);
-        return;
-    }
-
-    ret = blk_pread(exp->common.blk, offset, size, buf, 0);
-    if (ret >= 0) {
-        fuse_reply_buf(req, buf, size);
-    } else {
-        fuse_reply_err(req, -ret);
-    }
-
-    qemu_vfree(buf);
+    r = g_new(FuseRequest, 1);
+    *r = (FuseRequest) {
+        .exp = exp,
+        .req = req,
+        .offset = offset,
+        .size = size,
+    };
+    fuse_dispatch_request(r, fuse_co_read_entry);
 }
 
 /**
@@ -624,6 +748,7 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
                        size_t size, off_t offset, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
+    FuseRequest *r;
     int64_t length;
     int ret;
 
@@ -660,12 +785,21 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
         }
     }
 
-    ret = blk_pwrite(exp->common.blk, offset, size, buf, 0);
-    if (ret >= 0) {
-        fuse_reply_write(req, size);
-    } else {
-        fuse_reply_err(req, -ret);
-    }
+    /*
+     * @buf points into the receive buffer, so take it over instead of
+     * copying the data; a new one is allocated for the next request.
+     */
+    r = g_new(FuseRequest, 1);
+    *r = (FuseRequest) {
+        .exp = exp,
+        .req = req,
+        .offset = offset,
+        .size = size,
+        .buf = buf,
+        .buf_mem = exp->fuse_buf.mem,
+    };
+    exp->fuse_buf.mem = NULL;
+    fuse_dispatch_request(r, fuse_co_write_entry);
 }
 
 /**
@@ -776,10 +910,14 @@ static void fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
                        struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
-    int ret;
+    FuseRequest *r;
 
-    ret = blk_flush(exp->common.blk);
-    fuse_reply_err(req, ret < 0 ? -ret : 0);
+    r = g_new(FuseRequest, 1);
+    *r = (FuseRequest) {
+        .exp = exp,
+        .req = req,
+    };
+    fuse_dispatch_request(r, fuse_co_flush_entry);
 }
 
 /**
@@ -14,8 +14,11 @@
 #include <sys/eventfd.h>
 
 #include "qapi/error.h"
+#include "qapi/clone-visitor.h"
+#include "qapi/qapi-visit-common.h"
 #include "block/export.h"
 #include "qemu/error-report.h"
+#include "system/iothread-vq-mapping.h"
 #include "util/block-helpers.h"
 #include "subprojects/libvduse/libvduse.h"
 #include "virtio-blk-handler.h"
@@ -33,6 +36,14 @@ typedef struct VduseBlkExport {
     char *recon_file;
     unsigned int inflight; /* atomic */
     bool vqs_started;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
+    AioContext **vq_aio_context;
+
+    /*
+     * libvduse is not thread-safe. Taken around libvduse calls when
+     * virtqueues are processed in several AioContexts.
+     */
+    QemuMutex vduse_lock;
 } VduseBlkExport;
 
 typedef struct VduseBlkReq {
@@ -59,10 +70,27 @@ static void vduse_blk_inflight_dec(VduseBlkExport *vblk_exp)
     }
 }
 
-static void vduse_blk_req_complete(VduseBlkReq *req, size_t in_len)
+static void vduse_blk_lock(VduseBlkExport *vblk_exp)
+{
+    if (vblk_exp->vq_aio_context) {
+        qemu_mutex_lock(&vblk_exp->vduse_lock);
+    }
+}
+
+static void vduse_blk_unlock(VduseBlkExport *vblk_exp)
 {
+    if (vblk_exp->vq_aio_context) {
+        qemu_mutex_unlock(&vblk_exp->vduse_lock);
+    }
+}
+
+static void vduse_blk_req_complete(VduseBlkExport *vblk_exp, VduseBlkReq *req,
+                                   size_t in_len)
+{
+    vduse_blk_lock(vblk_exp);
     vduse_queue_push(req->vq, &req->elem, in_len);
     vduse_queue_notify(req->vq);
+    vduse_blk_unlock(vblk_exp);
 
     free(req);
 }
@@ -88,7 +116,7 @@ static void coroutine_fn vduse_blk_virtio_process_req(void *opaque)
         return;
     }
 
-    vduse_blk_req_complete(req, in_len);
+    vduse_blk_req_complete(vblk_exp, req, in_len);
     vduse_blk_inflight_dec(vblk_exp);
 }
 
@@ -99,7 +127,9 @@ static void vduse_blk_vq_handler(VduseDev *dev, VduseVirtq *vq)
     while (1) {
         VduseBlkReq *req;
 
+        vduse_blk_lock(vblk_exp);
         req = vduse_queue_pop(vq, sizeof(VduseBlkReq));
+        vduse_blk_unlock(vblk_exp);
         if (!req) {
             break;
         }
@@ -128,6 +158,20 @@ static void on_vduse_vq_kick(void *opaque)
     vduse_blk_vq_handler(dev, vq);
 }
 
+/* Returns the AioContext in which @vq is processed */
+static AioContext *vduse_blk_vq_aio_context(VduseBlkExport *vblk_exp,
+                                            VduseVirtq *vq)
+{
+    if (vblk_exp->vq_aio_context) {
+        for (uint16_t i = 0; i < vblk_exp->num_queues; i++) {
+            if (vduse_dev_get_queue(vblk_exp->dev, i) == vq) {
+                return vblk_exp->vq_aio_context[i];
+            }
+        }
+    }
+    return vblk_exp->export.ctx;
+}
+
 static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
@@ -136,7 +180,8 @@ static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
         return; /* vduse_blk_drained_end() will start vqs later */
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_queue_get_fd(vq),
+    aio_set_fd_handler(vduse_blk_vq_aio_context(vblk_exp, vq),
+                       vduse_queue_get_fd(vq),
                        on_vduse_vq_kick, NULL, NULL, NULL, vq);
     /* Make sure we don't miss any kick after reconnecting */
     eventfd_write(vduse_queue_get_fd(vq), 1);
@@ -151,7 +196,7 @@ static void vduse_blk_disable_queue(VduseDev *dev, VduseVirtq *vq)
         return;
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, fd,
+    aio_set_fd_handler(vduse_blk_vq_aio_context(vblk_exp, vq), fd,
                        NULL, NULL, NULL, NULL, NULL);
 }
 
@@ -163,8 +208,11 @@ static const VduseOps vduse_blk_ops = {
 static void on_vduse_dev_kick(void *opaque)
 {
     VduseDev *dev = opaque;
+    VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
 
+    vduse_blk_lock(vblk_exp);
     vduse_dev_handler(dev);
+    vduse_blk_unlock(vblk_exp);
 }
 
 static void vduse_blk_attach_ctx(VduseBlkExport *vblk_exp, AioContext *ctx)
@@ -265,6 +313,19 @@ static const BlockDevOps vduse_block_ops = {
     .drained_poll  = vduse_blk_drained_poll,
 };
 
+static void vduse_blk_free_vq_aio_context(VduseBlkExport *vblk_exp)
+{
+    if (vblk_exp->iothread_vq_mapping_list) {
+        iothread_vq_mapping_cleanup(vblk_exp->iothread_vq_mapping_list);
+        qapi_free_IOThreadVirtQueueMappingList(
+            vblk_exp->iothread_vq_mapping_list);
+        vblk_exp->iothread_vq_mapping_list = NULL;
+    }
+    g_free(vblk_exp->vq_aio_context);
+    vblk_exp->vq_aio_context = NULL;
+    qemu_mutex_destroy(&vblk_exp->vduse_lock);
+}
+
 static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                                 Error **errp)
 {
@@ -301,6 +362,22 @@ static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
             return -EINVAL;
         }
     }
+
+    if (vblk_opts->iothread_vq_mapping) {
+        vblk_exp->vq_aio_context = g_new(AioContext *, num_queues);
+        if (!iothread_vq_mapping_apply(vblk_opts->iothread_vq_mapping,
+                                       vblk_exp->vq_aio_context, num_queues,
+                                       errp)) {
+            g_free(vblk_exp->vq_aio_context);
+            vblk_exp->vq_aio_context = NULL;
+            return -EINVAL;
+        }
+        vblk_exp->iothread_vq_mapping_list =
+            QAPI_CLONE(IOThreadVirtQueueMappingList,
+                       vblk_opts->iothread_vq_mapping);
+    }
+    qemu_mutex_init(&vblk_exp->vduse_lock);
+
     vblk_exp->num_queues = num_queues;
     vblk_exp->handler.blk = exp->blk;
     vblk_exp->handler.serial = g_strdup(vblk_opts->serial ?: "");
@@ -381,6 +458,7 @@ err:
     g_free(vblk_exp->recon_file);
 err_dev:
     g_free(vblk_exp->handler.serial);
+    vduse_blk_free_vq_aio_context(vblk_exp);
     return ret;
 }
 
@@ -400,6 +478,7 @@ static void vduse_blk_exp_delete(BlockExport *exp)
     }
     g_free(vblk_exp->recon_file);
     g_free(vblk_exp->handler.serial);
+    vduse_blk_free_vq_aio_context(vblk_exp);
 }
 
 /* Called with exp->ctx acquired */
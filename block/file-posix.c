@@ -36,6 +36,7 @@
 #include "block/thread-pool.h"
 #include "qemu/iov.h"
 #include "block/raw-aio.h"
+#include "exec/memory.h" /* for ram_block_discard_disable() */
 #include "qobject/qdict.h"
 #include "qobject/qstring.h"
 
@@ -77,6 +78,10 @@
 #include <linux/hdreg.h>
 #include <linux/magic.h>
 #include <scsi/sg.h>
+#ifdef HAVE_IO_URING_NVME_PASSTHRU
+#include <linux/nvme_ioctl.h>
+#include "block/nvme.h"
+#endif
 #ifdef __s390__
 #include <asm/dasd.h>
 #endif
@@ -161,8 +166,20 @@ typedef struct BDRVRawState {
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+    bool use_io_uring_fixed_bufs:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
+
+    /* NVMe generic character device (/dev/ngXnY), see raw_nvme_probe() */
+    struct {
+        uint32_t nsid;              /* 0 if not an NVMe generic device */
+        unsigned int lba_shift;
+        uint64_t size;
+        uint32_t max_transfer;
+        bool has_write_zeroes;
+        bool use_uring_cmd;         /* cleared if no ring can be set up */
+    } nvme;
     bool has_fallocate;
+    bool has_clone_range;   /* cleared from thread pool workers, atomic */
     bool needs_alignment;
     bool force_alignment;
     bool drop_cache;
@@ -562,6 +579,11 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+        {
+            .name = "io-uring-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM with io_uring (default: off)",
+        },
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -590,6 +612,111 @@ static QemuOptsList raw_runtime_opts = {
 
 static const char *const mutable_opts[] = { "x-check-cache-dropped", NULL };
 
+#ifdef HAVE_IO_URING_NVME_PASSTHRU
+/*
+ * Upper bound for NVMe passthrough transfers.  The kernel does not split
+ * passthrough commands, and the Linux NVMe PCI driver guarantees 128
+ * segments, i.e. 512 KiB with 4 KiB pages.
+ */
+#define RAW_NVME_MAX_TRANSFER (512 * KiB)
+
+static int raw_nvme_identify(int fd, uint32_t nsid, uint32_t cns, void *buf,
+                             Error **errp)
+{
+    struct nvme_admin_cmd cmd = {
+        .opcode = NVME_ADM_CMD_IDENTIFY,
+        .nsid = nsid,
+        .addr = (uintptr_t)buf,
+        .data_len = NVME_IDENTIFY_DATA_SIZE,
+        .cdw10 = cns,
+    };
+    int ret;
+
+    memset(buf, 0, NVME_IDENTIFY_DATA_SIZE);
+    ret = ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+    if (ret < 0) {
+        ret = -errno;
+        error_setg_errno(errp, -ret, "NVMe Identify (CNS %u) failed", cns);
+        return ret;
+    } else if (ret > 0) {
+        error_setg(errp, "NVMe Identify (CNS %u) failed with status 0x%x",
+                   cns, ret);
+        return -EIO;
+    }
+    return 0;
+}
+
+/*
+ * NVMe generic character devices do not support read(2)/write(2), but accept
+ * NVMe I/O commands through io_uring passthrough (IORING_OP_URING_CMD).  This
+ * bypasses the host block layer while the device stays bound to the host
+ * NVMe driver.
+ *
+ * Returns 0 and leaves s->nvme.nsid at 0 if @bs is not an NVMe generic
+ * character device.
+ */
+static int raw_nvme_probe(BlockDriverState *bs, Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+    QEMU_AUTO_VFREE union {
+        NvmeIdCtrl ctrl;
+        NvmeIdNs ns;
+    } *id = NULL;
+    NvmeLBAF *lbaf;
+    uint64_t max_transfer;
+    int nsid;
+    int ret;
+
+    nsid = ioctl(s->fd, NVME_IOCTL_ID);
+    if (nsid <= 0) {
+        return 0;
+    }
+
+    if (!s->use_linux_io_uring) {
+        error_setg(errp, "NVMe generic character devices require "
+                   "aio=io_uring");
+        return -EINVAL;
+    }
+
+    QEMU_BUILD_BUG_ON(sizeof(*id) != NVME_IDENTIFY_DATA_SIZE);
+    id = qemu_memalign(qemu_real_host_page_size(), sizeof(*id));
+
+    ret = raw_nvme_identify(s->fd, 0, NVME_ID_CNS_CTRL, id, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Assume the minimum memory page size of 4 KiB */
+    max_transfer = id->ctrl.mdts ? (4 * KiB) << id->ctrl.mdts : 0;
+    s->nvme.max_transfer = MIN_NON_ZERO(max_transfer, RAW_NVME_MAX_TRANSFER);
+    s->nvme.has_write_zeroes =
+        !!(le16_to_cpu(id->ctrl.oncs) & NVME_ONCS_WRITE_ZEROES);
+
+    ret = raw_nvme_identify(s->fd, nsid, NVME_ID_CNS_NS, id, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    lbaf = &id->ns.lbaf[NVME_ID_NS_FLBAS_INDEX(id->ns.flbas)];
+    if (lbaf->ms) {
+        error_setg(errp, "Namespaces with metadata are not supported");
+        return -ENOTSUP;
+    }
+    if (lbaf->ds < BDRV_SECTOR_BITS || lbaf->ds > 16 ||
+        (1 << lbaf->ds) > s->nvme.max_transfer) {
+        error_setg(errp, "Namespace has unsupported block size (2^%d)",
+                   lbaf->ds);
+        return -ENOTSUP;
+    }
+
+    s->nvme.nsid = nsid;
+    s->nvme.lba_shift = lbaf->ds;
+    s->nvme.size = le64_to_cpu(id->ns.nsze) << lbaf->ds;
+    s->nvme.use_uring_cmd = luring_has_cmd(sizeof(struct nvme_uring_cmd));
+    return 0;
+}
+#endif
+
 static int raw_open_common(BlockDriverState *bs, QDict *options,
                            int bdrv_flags, int open_flags,
                            bool device, Error **errp)
@@ -643,6 +770,14 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
 
+    s->use_io_uring_fixed_bufs =
+        qemu_opt_get_bool(opts, "io-uring-fixed-buffers", false);
+    if (s->use_io_uring_fixed_bufs && !s->use_linux_io_uring) {
+        error_setg(errp, "io-uring-fixed-buffers requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
                               ON_OFF_AUTO_AUTO, &local_err);
@@ -743,6 +878,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->has_discard = true;
     s->has_write_zeroes = true;
+    s->has_clone_range = true;
 
     if (fstat(s->fd, &st) < 0) {
         ret = -errno;
@@ -767,6 +903,14 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
             ret = -EINVAL;
             goto fail;
         }
+#ifdef HAVE_IO_URING_NVME_PASSTHRU
+        if (S_ISCHR(st.st_mode)) {
+            ret = raw_nvme_probe(bs, errp);
+            if (ret < 0) {
+                goto fail;
+            }
+        }
+#endif
     }
 #ifdef CONFIG_BLKZONED
     /*
@@ -808,7 +952,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     bs->supported_write_flags = BDRV_REQ_FUA;
     if (s->use_linux_aio && !laio_has_fua()) {
         bs->supported_write_flags &= ~BDRV_REQ_FUA;
-    } else if (s->use_linux_io_uring && !luring_has_fua()) {
+    } else if (s->use_linux_io_uring && !luring_has_fua() && !s->nvme.nsid) {
         bs->supported_write_flags &= ~BDRV_REQ_FUA;
     }
 
@@ -817,6 +961,19 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+
+    /*
+     * Registered buffers pin guest RAM, which conflicts with RAM discard
+     * (virtio-balloon, virtio-mem).
+     */
+    if (s->use_io_uring_fixed_bufs) {
+        ret = ram_block_discard_disable(true);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "ram_block_discard_disable() failed");
+            s->use_io_uring_fixed_bufs = false;
+            goto fail;
+        }
+    }
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -1490,6 +1647,18 @@ static void raw_refresh_limits(BlockDriverState *bs, Error **errp)
     BDRVRawState *s = bs->opaque;
     struct stat st;
 
+    if (s->nvme.nsid) {
+        /* The kernel bounces buffers that are not dword aligned */
+        bs->bl.request_alignment = 1 << s->nvme.lba_shift;
+        bs->bl.min_mem_alignment = 4;
+        bs->bl.opt_mem_alignment = qemu_real_host_page_size();
+        bs->bl.max_transfer = s->nvme.max_transfer;
+        /* Number of Logical Blocks is a 16-bit field */
+        bs->bl.max_pwrite_zeroes = 1ULL << (s->nvme.lba_shift + 16);
+        bs->bl.pwrite_zeroes_alignment = 1 << s->nvme.lba_shift;
+        return;
+    }
+
     s->needs_alignment = raw_needs_alignment(bs);
     raw_probe_alignment(bs, s->fd, errp);
 
@@ -1551,6 +1720,11 @@ static int hdev_probe_blocksizes(BlockDriverState *bs, BlockSizes *bsz)
     BDRVRawState *s = bs->opaque;
     int ret;
 
+    if (s->nvme.nsid) {
+        bsz->log = bsz->phys = 1 << s->nvme.lba_shift;
+        return 0;
+    }
+
     /* If DASD or zoned devices, get blocksizes */
     if (check_for_dasd(s->fd) < 0) {
         /* zoned devices are not DASD */
@@ -2165,6 +2339,48 @@ static int handle_aiocb_zone_mgmt(void *opaque)
 }
 #endif
 
+/*
+ * Try to share the extents of the source with the destination instead of
+ * copying the data.  This only works within a file system that supports
+ * reflinks and for ranges aligned to its block size.
+ */
+static int handle_aiocb_clone_range(RawPosixAIOData *aiocb)
+{
+#ifdef FICLONERANGE
+    BDRVRawState *s = aiocb->bs->opaque;
+    struct file_clone_range range = {
+        .src_fd         = aiocb->aio_fildes,
+        .src_offset     = aiocb->aio_offset,
+        .src_length     = aiocb->aio_nbytes,
+        .dest_offset    = aiocb->copy_range.aio_offset2,
+    };
+    int ret;
+
+    /* A length of 0 would mean "until the end of the source" */
+    if (!qatomic_read(&s->has_clone_range) || !aiocb->aio_nbytes) {
+        return -ENOTSUP;
+    }
+
+    do {
+        ret = ioctl(aiocb->copy_range.aio_fd2, FICLONERANGE, &range);
+    } while (ret != 0 && errno == EINTR);
+
+    trace_file_clone_range(aiocb->bs, aiocb->aio_fildes, aiocb->aio_offset,
+                           aiocb->copy_range.aio_fd2,
+                           aiocb->copy_range.aio_offset2, aiocb->aio_nbytes,
+                           ret < 0 ? -errno : 0);
+    if (ret == 0) {
+        return 0;
+    }
+
+    /* Other errors (e.g. unaligned ranges) may succeed on the next request */
+    if (errno == EOPNOTSUPP || errno == ENOTTY) {
+        qatomic_set(&s->has_clone_range, false);
+    }
+#endif
+    return -ENOTSUP;
+}
+
 static int handle_aiocb_copy_range(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -2172,6 +2388,10 @@ static int handle_aiocb_copy_range(void *opaque)
     off_t in_off = aiocb->aio_offset;
     off_t out_off = aiocb->copy_range.aio_offset2;
 
+    if (handle_aiocb_clone_range(aiocb) == 0) {
+        return 0;
+    }
+
     while (bytes) {
         ssize_t ret = copy_file_range(aiocb->aio_fildes, &in_off,
                                       aiocb->copy_range.aio_fd2, &out_off,
@@ -2463,6 +2683,116 @@ static inline bool raw_check_linux_io_uring(BDRVRawState *s)
 }
 #endif
 
+#ifdef HAVE_IO_URING_NVME_PASSTHRU
+/*
+ * Passthrough commands need big SQEs, which the rings for normal I/O do not
+ * pay for.  They go to a separate ring of the AioContext instead.
+ */
+static inline bool raw_check_linux_io_uring_cmd(BDRVRawState *s)
+{
+    Error *local_err = NULL;
+    AioContext *ctx;
+
+    if (!s->use_linux_io_uring || !s->nvme.use_uring_cmd) {
+        return false;
+    }
+
+    ctx = qemu_get_current_aio_context();
+    if (unlikely(!aio_setup_linux_io_uring_cmd(ctx, &local_err))) {
+        error_reportf_err(local_err, "Unable to use io_uring for NVMe "
+                                     "passthrough, falling back to ioctls: ");
+        s->nvme.use_uring_cmd = false;
+        return false;
+    }
+    return true;
+}
+
+static int handle_aiocb_nvme_cmd(void *opaque)
+{
+    RawPosixAIOData *aiocb = opaque;
+    int ret;
+
+    ret = RETRY_ON_EINTR(
+        ioctl(aiocb->aio_fildes, aiocb->ioctl.cmd, aiocb->ioctl.buf)
+    );
+    if (ret == -1) {
+        return -errno;
+    }
+
+    /* NVMe status code, if positive */
+    return ret;
+}
+
+/*
+ * Submit an NVMe I/O command for an NVMe generic character device.  @bytes
+ * must be 0 for commands without a logical block range.
+ *
+ * If no passthrough ring can be set up, fall back to the synchronous
+ * passthrough ioctls in the thread pool.
+ */
+static int coroutine_fn raw_co_nvme_cmd(BlockDriverState *bs, uint8_t opcode,
+                                        uint64_t offset, uint64_t bytes,
+                                        QEMUIOVector *qiov, uint32_t cdw12)
+{
+    BDRVRawState *s = bs->opaque;
+    uint64_t slba = offset >> s->nvme.lba_shift;
+    uint32_t cmd_op = NVME_URING_CMD_IO;
+    struct nvme_uring_cmd cmd = {
+        .opcode = opcode,
+        .nsid = s->nvme.nsid,
+        .cdw10 = slba & 0xFFFFFFFF,
+        .cdw11 = slba >> 32,
+    };
+    int ret;
+
+    if (bytes) {
+        assert((bytes >> s->nvme.lba_shift) <= 0x10000);
+        cmd.cdw12 = (((bytes >> s->nvme.lba_shift) - 1) & 0xFFFF) | cdw12;
+    }
+
+    if (qiov && qiov->niov == 1) {
+        cmd.addr = (uintptr_t)qiov->iov[0].iov_base;
+        cmd.data_len = qiov->iov[0].iov_len;
+    } else if (qiov) {
+        cmd_op = NVME_URING_CMD_IO_VEC;
+        cmd.addr = (uintptr_t)qiov->iov;
+        cmd.data_len = qiov->niov;
+    }
+
+    if (raw_check_linux_io_uring_cmd(s)) {
+        ret = luring_co_submit_cmd(bs, s->fd, cmd_op, &cmd, sizeof(cmd));
+    } else {
+        struct nvme_passthru_cmd64 pt = {
+            .opcode = cmd.opcode,
+            .nsid = cmd.nsid,
+            .addr = cmd.addr,
+            .data_len = cmd.data_len,
+            .cdw10 = cmd.cdw10,
+            .cdw11 = cmd.cdw11,
+            .cdw12 = cmd.cdw12,
+        };
+        RawPosixAIOData acb = {
+            .bs         = bs,
+            .aio_fildes = s->fd,
+            .aio_type   = QEMU_AIO_IOCTL,
+            .ioctl      = {
+                .cmd    = cmd_op == NVME_URING_CMD_IO_VEC ?
+                          NVME_IOCTL_IO64_CMD_VEC : NVME_IOCTL_IO64_CMD,
+                .buf    = &pt,
+            },
+        };
+
+        ret = raw_thread_pool_submit(handle_aiocb_nvme_cmd, &acb);
+    }
+    if (ret > 0) {
+        /* NVMe status code */
+        trace_file_nvme_cmd_status(bs, opcode, ret);
+        ret = -EIO;
+    }
+    return ret;
+}
+#endif
+
 #ifdef CONFIG_LINUX_AIO
 static inline bool raw_check_linux_aio(BDRVRawState *s)
 {
@@ -2495,6 +2825,17 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
 
     if (fd_open(bs) < 0)
         return -EIO;
+#ifdef HAVE_IO_URING_NVME_PASSTHRU
+    if (s->nvme.nsid) {
+        assert(qiov->size == bytes);
+        assert(type == QEMU_AIO_READ || type == QEMU_AIO_WRITE);
+        return raw_co_nvme_cmd(bs,
+                               type == QEMU_AIO_READ ? NVME_CMD_READ
+                                                     : NVME_CMD_WRITE,
+                               offset, bytes, qiov,
+                               flags & BDRV_REQ_FUA ? 1 << 30 : 0);
+    }
+#endif
 #if defined(CONFIG_BLKZONED)
     if ((type & (QEMU_AIO_WRITE | QEMU_AIO_ZONE_APPEND)) &&
         bs->bl.zoned != BLK_Z_NONE) {
@@ -2611,6 +2952,11 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
         .aio_type       = QEMU_AIO_FLUSH,
     };
 
+#ifdef HAVE_IO_URING_NVME_PASSTHRU
+    if (s->nvme.nsid) {
+        return raw_co_nvme_cmd(bs, NVME_CMD_FLUSH, 0, 0, NULL, 0);
+    }
+#endif
 #ifdef CONFIG_LINUX_IO_URING
     if (raw_check_linux_io_uring(s)) {
         return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH, 0);
@@ -2635,8 +2981,34 @@ static void raw_close(BlockDriverState *bs)
         qemu_close(s->fd);
         s->fd = -1;
     }
+
+    if (s->use_io_uring_fixed_bufs) {
+        ram_block_discard_disable(false);
+    }
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_io_uring_fixed_bufs) {
+        luring_register_buf(host, size);
+    }
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_io_uring_fixed_bufs) {
+        luring_unregister_buf(host, size);
+    }
+}
+#endif
+
 /**
  * Truncates the given regular file @fd to @offset and, when growing, fills the
  * new space according to @prealloc.
@@ -2865,6 +3237,10 @@ static int64_t raw_getlength(BlockDriverState *bs)
         return ret;
     }
 
+    if (s->nvme.nsid) {
+        return s->nvme.size;
+    }
+
     size = lseek(s->fd, 0, SEEK_END);
     if (size < 0) {
         return -errno;
@@ -3929,6 +4305,10 @@ BlockDriver bdrv_file = {
     .bdrv_check_perm = raw_check_perm,
     .bdrv_set_perm   = raw_set_perm,
     .bdrv_abort_perm_update = raw_abort_perm_update,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#endif
     .create_opts = &raw_create_opts,
     .mutable_opts = mutable_opts,
 };
@@ -4242,12 +4622,18 @@ hdev_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
         raw_account_discard(s, bytes, ret);
         return ret;
     }
+    if (s->nvme.nsid) {
+        /* Dataset Management is not implemented for NVMe passthrough */
+        raw_account_discard(s, bytes, -ENOTSUP);
+        return -ENOTSUP;
+    }
     return raw_do_pdiscard(bs, offset, bytes, true);
 }
 
 static coroutine_fn int hdev_co_pwrite_zeroes(BlockDriverState *bs,
     int64_t offset, int64_t bytes, BdrvRequestFlags flags)
 {
+    BDRVRawState *s = bs->opaque;
     int rc;
 
     rc = fd_open(bs);
@@ -4255,6 +4641,16 @@ static coroutine_fn int hdev_co_pwrite_zeroes(BlockDriverState *bs,
         return rc;
     }
 
+    if (s->nvme.nsid) {
+#ifdef HAVE_IO_URING_NVME_PASSTHRU
+        if (s->nvme.has_write_zeroes) {
+            return raw_co_nvme_cmd(bs, NVME_CMD_WRITE_ZEROES, offset, bytes,
+                                   NULL, flags & BDRV_REQ_FUA ? 1 << 30 : 0);
+        }
+#endif
+        return -ENOTSUP;
+    }
+
     return raw_do_pwrite_zeroes(bs, offset, bytes, flags, true);
 }
 
@@ -4295,6 +4691,10 @@ static BlockDriver bdrv_host_device = {
     .bdrv_abort_perm_update = raw_abort_perm_update,
     .bdrv_probe_blocksizes = hdev_probe_blocksizes,
     .bdrv_probe_geometry = hdev_probe_geometry,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#endif
 
     /* generic scsi device */
 #ifdef __linux__
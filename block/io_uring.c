@@ -16,6 +16,9 @@
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
 #include "qemu/defer-call.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "system/block-backend.h"
 #include "trace.h"
@@ -26,12 +29,23 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* The kernel refuses to register buffers larger than 1 GiB */
+#define MAX_FIXED_BUF_SIZE (1 * GiB)
+
+/* Idle time of the kernel submission queue polling thread */
+#define SQPOLL_IDLE_MS 1000
+
 typedef struct LuringAIOCB {
     Coroutine *co;
-    struct io_uring_sqe sqeq;
+    union {
+        struct io_uring_sqe sqeq;
+        /* Rings with big SQEs take an additional 64 bytes of command data */
+        uint8_t sqeq_big[2 * sizeof(struct io_uring_sqe)];
+    };
     ssize_t ret;
     QEMUIOVector *qiov;
     bool is_read;
+    int64_t submit_ns;
     QSIMPLEQ_ENTRY(LuringAIOCB) next;
 
     /*
@@ -53,13 +67,220 @@ struct LuringState {
     AioContext *aio_context;
 
     struct io_uring ring;
+    size_t sqe_size;    /* 128 if the ring uses IORING_SETUP_SQE128 */
 
     /* No locking required, only accessed from AioContext home thread */
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /*
+     * Buffers registered with the ring, sorted by address.  Also only
+     * accessed from the AioContext home thread.  @fixed_bufs_gen is the
+     * luring_bufs_gen value the registration corresponds to.
+     */
+    struct iovec *fixed_bufs;
+    unsigned int nr_fixed_bufs;
+    unsigned int fixed_bufs_gen;
+
+    /* Scheduled from any thread when luring_bufs changes */
+    QEMUBH *fixed_bufs_bh;
+
+    /* Protected by luring_bufs_lock */
+    QLIST_ENTRY(LuringState) next;
+
+    AioEngineStats stats;
 };
 
+/*
+ * Memory regions that should be registered as fixed buffers, see
+ * luring_register_buf().  The list is shared by all rings, a change
+ * schedules the fixed_bufs_bh of every ring attached to an AioContext, which
+ * picks it up as soon as the ring is idle.
+ */
+typedef struct LuringBuf {
+    void *host;
+    size_t size;
+    unsigned int refcnt;
+} LuringBuf;
+
+static QemuMutex luring_bufs_lock;
+static GArray *luring_bufs;             /* protected by luring_bufs_lock */
+static unsigned int luring_bufs_gen;    /* changed under luring_bufs_lock */
+
+/* Rings attached to an AioContext, protected by luring_bufs_lock */
+static QLIST_HEAD(, LuringState) luring_rings;
+
+static void __attribute__((__constructor__)) luring_bufs_init(void)
+{
+    qemu_mutex_init(&luring_bufs_lock);
+    luring_bufs = g_array_new(FALSE, FALSE, sizeof(LuringBuf));
+}
+
+/* Called with luring_bufs_lock held */
+static void luring_bufs_changed(void)
+{
+    LuringState *s;
+
+    qatomic_set(&luring_bufs_gen, luring_bufs_gen + 1);
+
+    QLIST_FOREACH(s, &luring_rings, next) {
+        qemu_bh_schedule(s->fixed_bufs_bh);
+    }
+}
+
+/**
+ * luring_register_buf:
+ * @host: start of the memory region
+ * @size: size of the memory region
+ *
+ * Ask all rings to register @host as a fixed buffer so that requests whose
+ * data lies in it can use IORING_OP_READ_FIXED/IORING_OP_WRITE_FIXED and
+ * avoid mapping the pages for every request.  Registration pins the memory.
+ *
+ * Calls are reference counted, each must be paired with
+ * luring_unregister_buf().
+ */
+void luring_register_buf(void *host, size_t size)
+{
+    LuringBuf *buf;
+    unsigned int i;
+
+    QEMU_LOCK_GUARD(&luring_bufs_lock);
+
+    for (i = 0; i < luring_bufs->len; i++) {
+        buf = &g_array_index(luring_bufs, LuringBuf, i);
+        if (buf->host == host && buf->size == size) {
+            buf->refcnt++;
+            return;
+        }
+        if ((uintptr_t)buf->host > (uintptr_t)host) {
+            break;
+        }
+    }
+
+    g_array_insert_val(luring_bufs, i,
+                       ((LuringBuf) { .host = host, .size = size,
+                                      .refcnt = 1 }));
+    luring_bufs_changed();
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    LuringBuf *buf;
+    unsigned int i;
+
+    QEMU_LOCK_GUARD(&luring_bufs_lock);
+
+    for (i = 0; i < luring_bufs->len; i++) {
+        buf = &g_array_index(luring_bufs, LuringBuf, i);
+        if (buf->host == host && buf->size == size) {
+            if (--buf->refcnt == 0) {
+                g_array_remove_index(luring_bufs, i);
+                luring_bufs_changed();
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * luring_update_fixed_bufs:
+ *
+ * Bring the buffers registered with the ring in sync with luring_bufs.  The
+ * buffer table can only be replaced safely while no request refers to it, so
+ * this does nothing unless the ring is idle; luring_process_completions()
+ * retries once the last request has completed.  If registration fails (e.g.
+ * because RLIMIT_MEMLOCK is too low) requests keep using the vectored
+ * operations until the next change to luring_bufs.
+ */
+static void luring_update_fixed_bufs(LuringState *s)
+{
+    g_autofree struct iovec *iov = NULL;
+    unsigned int nr_iov = 0;
+    unsigned int i;
+    int ret;
+
+    if (s->fixed_bufs_gen == qatomic_read(&luring_bufs_gen) ||
+        s->io_q.in_flight > 0 || s->io_q.in_queue > 0) {
+        return;
+    }
+
+    if (s->nr_fixed_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+        g_free(s->fixed_bufs);
+        s->fixed_bufs = NULL;
+        s->nr_fixed_bufs = 0;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&luring_bufs_lock) {
+        s->fixed_bufs_gen = luring_bufs_gen;
+
+        for (i = 0; i < luring_bufs->len; i++) {
+            LuringBuf *buf = &g_array_index(luring_bufs, LuringBuf, i);
+            nr_iov += DIV_ROUND_UP(buf->size, MAX_FIXED_BUF_SIZE);
+        }
+        if (nr_iov == 0) {
+            return;
+        }
+
+        iov = g_new(struct iovec, nr_iov);
+        nr_iov = 0;
+        for (i = 0; i < luring_bufs->len; i++) {
+            LuringBuf *buf = &g_array_index(luring_bufs, LuringBuf, i);
+            size_t done;
+
+            for (done = 0; done < buf->size; done += MAX_FIXED_BUF_SIZE) {
+                iov[nr_iov++] = (struct iovec) {
+                    .iov_base = buf->host + done,
+                    .iov_len = MIN(buf->size - done, MAX_FIXED_BUF_SIZE),
+                };
+            }
+        }
+    }
+
+    ret = io_uring_register_buffers(&s->ring, iov, nr_iov);
+    trace_luring_register_buffers(s, nr_iov, ret);
+    if (ret < 0) {
+        return;
+    }
+
+    s->fixed_bufs = g_steal_pointer(&iov);
+    s->nr_fixed_bufs = nr_iov;
+}
+
+/*
+ * Return the index of the registered buffer that contains @iov, or -1 if
+ * there is none.
+ */
+static int luring_fixed_buf_index(LuringState *s, const struct iovec *iov)
+{
+    uintptr_t start = (uintptr_t)iov->iov_base;
+    unsigned int lo = 0, hi = s->nr_fixed_bufs;
+
+    /* Don't use a table that may refer to unregistered memory */
+    if (s->fixed_bufs_gen != qatomic_read(&luring_bufs_gen)) {
+        return -1;
+    }
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        uintptr_t base = (uintptr_t)s->fixed_bufs[mid].iov_base;
+
+        if (start < base) {
+            hi = mid;
+        } else if (start - base >= s->fixed_bufs[mid].iov_len) {
+            lo = mid + 1;
+        } else {
+            if (iov->iov_len > s->fixed_bufs[mid].iov_len - (start - base)) {
+                return -1;
+            }
+            return mid;
+        }
+    }
+    return -1;
+}
+
 /**
  * luring_resubmit:
  *
@@ -90,6 +311,15 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     luringcb->total_read += nread;
     remaining = luringcb->qiov->size - luringcb->total_read;
 
+    /* Fixed buffer requests have a single contiguous buffer */
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        luringcb->sqeq.off += nread;
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len = remaining;
+        luring_resubmit(s, luringcb);
+        return;
+    }
+
     /* Shorten qiov */
     resubmit_qiov = &luringcb->resubmit_qiov;
     if (resubmit_qiov->iov == NULL) {
@@ -206,6 +436,7 @@ static void luring_process_completions(LuringState *s)
             }
         }
 end:
+        aio_engine_stats_completed(&s->stats, luringcb->submit_ns);
         luringcb->ret = ret;
         qemu_iovec_destroy(&luringcb->resubmit_qiov);
 
@@ -223,6 +454,12 @@ end:
 
     qemu_bh_cancel(s->completion_bh);
 
+    /* A buffer update may have been put off while requests were pending */
+    if (s->io_q.in_flight == 0 && s->io_q.in_queue == 0 &&
+        s->fixed_bufs_gen != qatomic_read(&luring_bufs_gen)) {
+        qemu_bh_schedule(s->fixed_bufs_bh);
+    }
+
     defer_call_end();
 }
 
@@ -243,11 +480,12 @@ static int ioq_submit(LuringState *s)
                 break;
             }
             /* Prep sqe for submission */
-            *sqes = luringcb->sqeq;
+            memcpy(sqes, luringcb->sqeq_big, s->sqe_size);
             QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
         }
         ret = io_uring_submit(&s->ring);
         trace_luring_io_uring_submit(s, ret);
+        aio_engine_stats_submitted(&s->stats, ret);
         /* Prevent infinite loop if submission is refused */
         if (ret <= 0) {
             if (ret == -EAGAIN || ret == -EINTR) {
@@ -285,6 +523,12 @@ static void qemu_luring_completion_bh(void *opaque)
     luring_process_completions_and_submit(s);
 }
 
+static void qemu_luring_fixed_bufs_bh(void *opaque)
+{
+    LuringState *s = opaque;
+    luring_update_fixed_bufs(s);
+}
+
 static void qemu_luring_completion_cb(void *opaque)
 {
     LuringState *s = opaque;
@@ -323,6 +567,8 @@ static void luring_deferred_fn(void *opaque)
     }
 }
 
+static int luring_enqueue(LuringState *s, LuringAIOCB *luringcb);
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -337,11 +583,27 @@ static void luring_deferred_fn(void *opaque)
 static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                             uint64_t offset, int type, BdrvRequestFlags flags)
 {
-    int ret;
+    int buf_index = -1;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
 
+    if ((type == QEMU_AIO_READ || type == QEMU_AIO_WRITE) &&
+        s->nr_fixed_bufs && luringcb->qiov->niov == 1) {
+        buf_index = luring_fixed_buf_index(s, &luringcb->qiov->iov[0]);
+    }
+
     switch (type) {
     case QEMU_AIO_WRITE:
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len, offset,
+                                      buf_index);
+#ifdef HAVE_IO_URING_PREP_WRITEV2
+            sqes->rw_flags = (flags & BDRV_REQ_FUA) ? RWF_DSYNC : 0;
+#else
+            assert(flags == 0);
+#endif
+            break;
+        }
 #ifdef HAVE_IO_URING_PREP_WRITEV2
     {
         int luring_flags = (flags & BDRV_REQ_FUA) ? RWF_DSYNC : 0;
@@ -359,6 +621,12 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                              luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_READ:
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len, offset,
+                                     buf_index);
+            break;
+        }
         io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
                             luringcb->qiov->niov, offset);
         break;
@@ -372,12 +640,38 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     }
     io_uring_sqe_set_data(sqes, luringcb);
 
+    return luring_enqueue(s, luringcb);
+}
+
+static uint64_t luring_max_batch(LuringState *s)
+{
+    uint64_t max_batch = s->aio_context->aio_max_batch ?:
+                         aio_engine_batch_limit(&s->stats, s->io_q.in_flight);
+
+    stat64_set(&s->stats.batch_limit, max_batch);
+    return max_batch;
+}
+
+/**
+ * luring_enqueue:
+ * @s: AIO state
+ * @luringcb: AIO control block with a prepared sqe
+ *
+ * Adds the request to the pending queue and submits the queue if it is full
+ * or unplugged.
+ */
+static int luring_enqueue(LuringState *s, LuringAIOCB *luringcb)
+{
+    int ret;
+
+    luringcb->submit_ns = get_clock();
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
     s->io_q.in_queue++;
     trace_luring_do_submit(s, s->io_q.blocked, s->io_q.in_queue,
                            s->io_q.in_flight);
     if (!s->io_q.blocked) {
-        if (s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES) {
+        if (s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES ||
+            s->io_q.in_queue >= luring_max_batch(s)) {
             ret = ioq_submit(s);
             trace_luring_do_submit_done(s, ret);
             return ret;
@@ -415,11 +709,81 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
     return luringcb.ret;
 }
 
+#ifdef HAVE_IO_URING_NVME_PASSTHRU
+/*
+ * Return whether the passthrough rings can carry luring_co_submit_cmd()
+ * requests with a payload of @cmd_len bytes.
+ */
+bool luring_has_cmd(size_t cmd_len)
+{
+    return cmd_len <= 2 * sizeof(struct io_uring_sqe) -
+                      offsetof(struct io_uring_sqe, cmd);
+}
+
+/**
+ * luring_co_submit_cmd:
+ * @bs: block driver state, for tracing
+ * @fd: file descriptor of the character device
+ * @cmd_op: driver-specific command operation (e.g. NVME_URING_CMD_IO)
+ * @cmd: driver-specific command payload
+ * @cmd_len: size of @cmd
+ *
+ * Submit an IORING_OP_URING_CMD request on the passthrough ring of the
+ * thread's current AioContext, see aio_setup_linux_io_uring_cmd().  Any data
+ * buffers must be referenced by @cmd itself.
+ *
+ * Returns: the result of the command, which may be a positive driver-specific
+ * status, or -errno.  -ENOTSUP if the ring has no room for @cmd.
+ */
+int coroutine_fn luring_co_submit_cmd(BlockDriverState *bs, int fd,
+                                      uint32_t cmd_op, const void *cmd,
+                                      size_t cmd_len)
+{
+    int ret;
+    AioContext *ctx = qemu_get_current_aio_context();
+    LuringState *s = aio_get_linux_io_uring_cmd(ctx);
+    LuringAIOCB luringcb = {
+        .co         = qemu_coroutine_self(),
+        .ret        = -EINPROGRESS,
+    };
+    struct io_uring_sqe *sqes = &luringcb.sqeq;
+
+    trace_luring_co_submit_cmd(bs, s, &luringcb, fd, cmd_op);
+
+    if (cmd_len > s->sqe_size - offsetof(struct io_uring_sqe, cmd)) {
+        return -ENOTSUP;
+    }
+
+    memset(luringcb.sqeq_big, 0, sizeof(luringcb.sqeq_big));
+    sqes->opcode = IORING_OP_URING_CMD;
+    sqes->fd = fd;
+    sqes->cmd_op = cmd_op;
+    memcpy(sqes->cmd, cmd, cmd_len);
+    io_uring_sqe_set_data(sqes, &luringcb);
+
+    ret = luring_enqueue(s, &luringcb);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (luringcb.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return luringcb.ret;
+}
+
+#endif /* HAVE_IO_URING_NVME_PASSTHRU */
+
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
     aio_set_fd_handler(old_context, s->ring.ring_fd,
                        NULL, NULL, NULL, NULL, s);
     qemu_bh_delete(s->completion_bh);
+
+    WITH_QEMU_LOCK_GUARD(&luring_bufs_lock) {
+        QLIST_REMOVE(s, next);
+    }
+    qemu_bh_delete(s->fixed_bufs_bh);
     s->aio_context = NULL;
 }
 
@@ -427,20 +791,56 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
 {
     s->aio_context = new_context;
     s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
+    s->fixed_bufs_bh = aio_bh_new(new_context, qemu_luring_fixed_bufs_bh, s);
+
+    WITH_QEMU_LOCK_GUARD(&luring_bufs_lock) {
+        QLIST_INSERT_HEAD(&luring_rings, s, next);
+    }
+    /* Pick up buffers that were registered before the ring existed */
+    qemu_bh_schedule(s->fixed_bufs_bh);
     aio_set_fd_handler(s->aio_context, s->ring.ring_fd,
                        qemu_luring_completion_cb, NULL,
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+static int luring_queue_init(struct io_uring *ring, unsigned int flags)
+{
+    struct io_uring_params params = {
+        .flags = flags,
+        .sq_thread_idle = SQPOLL_IDLE_MS,
+    };
+
+    return io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
+}
+
+/*
+ * Create a ring, with a kernel submission queue polling thread if @sqpoll is
+ * set.  If @big_sqe is set, the ring uses 128 byte SQEs and 32 byte CQEs as
+ * needed for NVMe passthrough commands; such a ring is never created without
+ * them, but falls back to interrupt-driven submission first.
+ */
+LuringState *luring_init(bool sqpoll, bool big_sqe, Error **errp)
 {
     int rc;
+    unsigned int flags = 0;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    s->sqe_size = sizeof(struct io_uring_sqe);
+    if (big_sqe) {
+        flags |= IORING_SETUP_SQE128 | IORING_SETUP_CQE32;
+        s->sqe_size *= 2;
+    }
+
+    rc = luring_queue_init(ring, flags | (sqpoll ? IORING_SETUP_SQPOLL : 0));
+    if (rc < 0 && sqpoll) {
+        warn_report_once("io_uring submission queue polling is not "
+                         "available (%s), using interrupt-driven "
+                         "submission", strerror(-rc));
+        rc = luring_queue_init(ring, flags);
+    }
     if (rc < 0) {
         error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
@@ -455,10 +855,16 @@ LuringState *luring_init(Error **errp)
 void luring_cleanup(LuringState *s)
 {
     io_uring_queue_exit(&s->ring);
+    g_free(s->fixed_bufs);
     trace_luring_cleanup_state(s);
     g_free(s);
 }
 
+AioEngineStats *luring_get_stats(LuringState *s)
+{
+    return &s->stats;
+}
+
 bool luring_has_fua(void)
 {
 #ifdef HAVE_IO_URING_PREP_WRITEV2
@@ -33,9 +33,6 @@
  */
 #define MAX_EVENTS 1024
 
-/* Maximum number of requests in a batch. (default value) */
-#define DEFAULT_MAX_BATCH 32
-
 struct qemu_laiocb {
     Coroutine *co;
     LinuxAioState *ctx;
@@ -44,6 +41,7 @@ struct qemu_laiocb {
     size_t nbytes;
     QEMUIOVector *qiov;
     bool is_read;
+    int64_t submit_ns;
     QSIMPLEQ_ENTRY(qemu_laiocb) next;
 };
 
@@ -65,6 +63,8 @@ struct LinuxAioState {
     QEMUBH *completion_bh;
     int event_idx;
     int event_max;
+
+    AioEngineStats stats;
 };
 
 static void ioq_submit(LinuxAioState *s);
@@ -218,6 +218,7 @@ static void qemu_laio_process_completions(LinuxAioState *s)
                 container_of(iocb, struct qemu_laiocb, iocb);
 
             laiocb->ret = io_event_ret(&events[s->event_idx]);
+            aio_engine_stats_completed(&s->stats, laiocb->submit_ns);
 
             /* Change counters one-by-one because we can be nested. */
             s->io_q.in_flight--;
@@ -307,6 +308,7 @@ static void ioq_submit(LinuxAioState *s)
         }
 
         ret = io_submit(s->ctx, len, iocbs);
+        aio_engine_stats_submitted(&s->stats, ret);
         if (ret == -EAGAIN) {
             break;
         }
@@ -343,7 +345,8 @@ static void ioq_submit(LinuxAioState *s)
 
 static uint64_t laio_max_batch(LinuxAioState *s, uint64_t dev_max_batch)
 {
-    uint64_t max_batch = s->aio_context->aio_max_batch ?: DEFAULT_MAX_BATCH;
+    uint64_t max_batch = s->aio_context->aio_max_batch ?:
+                         aio_engine_batch_limit(&s->stats, s->io_q.in_flight);
 
     /*
      * AIO context can be shared between multiple block devices, so
@@ -355,6 +358,7 @@ static uint64_t laio_max_batch(LinuxAioState *s, uint64_t dev_max_batch)
     /* limit the batch with the number of available events */
     max_batch = MIN_NON_ZERO(MAX_EVENTS - s->io_q.in_flight, max_batch);
 
+    stat64_set(&s->stats.batch_limit, max_batch);
     return max_batch;
 }
 
@@ -403,6 +407,7 @@ static int laio_do_submit(int fd, struct qemu_laiocb *laiocb, off_t offset,
         return -EIO;
     }
     io_set_eventfd(&laiocb->iocb, event_notifier_get_fd(&s->e));
+    laiocb->submit_ns = get_clock();
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.pending, laiocb, next);
     s->io_q.in_queue++;
@@ -460,6 +465,11 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context)
                            qemu_laio_poll_ready);
 }
 
+AioEngineStats *laio_get_stats(LinuxAioState *s)
+{
+    return &s->stats;
+}
+
 LinuxAioState *laio_init(Error **errp)
 {
     int rc;
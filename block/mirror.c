@@ -24,10 +24,17 @@
 #include "qemu/ratelimit.h"
 #include "qemu/bitmap.h"
 #include "qemu/memalign.h"
+#include "qemu/units.h"
 
-#define MAX_IN_FLIGHT 16
+#define MIN_IN_FLIGHT 1
+#define DEFAULT_IN_FLIGHT 16
+#define MAX_IN_FLIGHT 64
+#define MIN_IO_BYTES (64 * KiB)
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
-#define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
+#define DEFAULT_MIRROR_BUF_SIZE (DEFAULT_IN_FLIGHT * MAX_IO_BYTES)
+
+/* How often the in-flight limit and chunk size are reconsidered */
+#define MIRROR_ADAPT_INTERVAL_NS (100 * SCALE_MS)
 
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
@@ -94,6 +101,23 @@ typedef struct MirrorBlockJob {
     bool prepared;
     bool in_drain;
     bool base_ro;
+
+    /*
+     * Limits for background copying, adapted to the target by
+     * mirror_adapt().  Written with atomics, so that they can be read by
+     * mirror_query().
+     */
+    unsigned max_in_flight;
+    size_t max_io_bytes;
+    /* Statistics for the current adaptation window */
+    int64_t adapt_window_start_ns;
+    uint64_t adapt_window_bytes;
+    uint64_t adapt_window_ops;
+    int64_t adapt_window_latency_ns;
+    /* Bytes per millisecond in the previous window */
+    uint64_t last_throughput;
+    /* Lowest recently seen average request latency */
+    int64_t baseline_latency_ns;
 } MirrorBlockJob;
 
 typedef struct MirrorBDSOpaque {
@@ -115,6 +139,7 @@ struct MirrorOp {
     bool is_pseudo_op;
     bool is_active_write;
     bool is_in_flight;
+    int64_t start_ns;
     CoQueue waiting_requests;
     Coroutine *co;
     MirrorOp *waiting_for_op;
@@ -194,6 +219,76 @@ static void coroutine_fn mirror_wait_on_conflicts(MirrorOp *self,
     }
 }
 
+static void mirror_adapt_window_reset(MirrorBlockJob *s, int64_t now)
+{
+    s->adapt_window_start_ns = now;
+    s->adapt_window_bytes = 0;
+    s->adapt_window_ops = 0;
+    s->adapt_window_latency_ns = 0;
+}
+
+/*
+ * AIMD control of the background copy concurrency.  As long as the target
+ * keeps up, the number of requests in flight is increased one by one, and
+ * once that hits its limit, the chunk size grows.  When latency rises well
+ * above the baseline without any gain in throughput, the target is only
+ * queueing requests, so the number of requests in flight is halved, and if
+ * that is already at its minimum, the chunk size.
+ */
+static void mirror_adapt(MirrorBlockJob *s, int64_t now)
+{
+    int64_t elapsed = now - s->adapt_window_start_ns;
+    int64_t min_io_bytes = MAX(s->granularity, MIN_IO_BYTES);
+    int64_t max_io_bytes = MAX(QEMU_ALIGN_DOWN(s->buf_size / 4, s->granularity),
+                               MAX(s->buf_size / DEFAULT_IN_FLIGHT,
+                                   MAX_IO_BYTES));
+    unsigned max_in_flight = s->max_in_flight;
+    int64_t io_bytes = s->max_io_bytes;
+    uint64_t throughput;
+    int64_t latency;
+
+    if (elapsed < MIRROR_ADAPT_INTERVAL_NS || !s->adapt_window_ops) {
+        return;
+    }
+
+    throughput = s->adapt_window_bytes / (elapsed / SCALE_MS);
+    latency = s->adapt_window_latency_ns / s->adapt_window_ops;
+
+    if (!s->baseline_latency_ns || latency < s->baseline_latency_ns) {
+        s->baseline_latency_ns = latency;
+    } else {
+        /* Let the baseline follow lasting changes, e.g. of the chunk size */
+        s->baseline_latency_ns += s->baseline_latency_ns / 64 + 1;
+    }
+
+    if (latency > 2 * s->baseline_latency_ns &&
+        throughput <= s->last_throughput) {
+        if (max_in_flight > MIN_IN_FLIGHT) {
+            max_in_flight = MAX(max_in_flight / 2, MIN_IN_FLIGHT);
+        } else {
+            io_bytes = MAX(QEMU_ALIGN_DOWN(io_bytes / 2, s->granularity),
+                           min_io_bytes);
+        }
+    } else if (throughput >= s->last_throughput) {
+        if (max_in_flight < MAX_IN_FLIGHT) {
+            max_in_flight++;
+        } else {
+            io_bytes = MIN(io_bytes + MAX_IO_BYTES, max_io_bytes);
+        }
+    }
+
+    if (io_bytes != s->max_io_bytes) {
+        /* Latency depends on the request size, start over */
+        s->baseline_latency_ns = 0;
+    }
+
+    trace_mirror_adapt(s, throughput, latency, max_in_flight, io_bytes);
+    qatomic_set(&s->max_in_flight, max_in_flight);
+    qatomic_set(&s->max_io_bytes, io_bytes);
+    s->last_throughput = throughput;
+    mirror_adapt_window_reset(s, now);
+}
+
 static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
@@ -218,6 +313,13 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
     bitmap_clear(s->in_flight_bitmap, chunk_num, nb_chunks);
     QTAILQ_REMOVE(&s->ops_in_flight, op, next);
     if (ret >= 0) {
+        int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+        s->adapt_window_bytes += op->bytes;
+        s->adapt_window_ops++;
+        s->adapt_window_latency_ns += now - op->start_ns;
+        mirror_adapt(s, now);
+
         if (s->cow_bitmap) {
             bitmap_set(s->cow_bitmap, chunk_num, nb_chunks);
         }
@@ -440,6 +542,12 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
     MirrorOp *op;
     Coroutine *co;
     int64_t bytes_handled = -1;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    /* Time spent idle says nothing about the target */
+    if (s->in_flight == 0) {
+        mirror_adapt_window_reset(s, now);
+    }
 
     op = g_new(MirrorOp, 1);
     *op = (MirrorOp){
@@ -447,6 +555,7 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
         .offset         = offset,
         .bytes          = bytes,
         .bytes_handled  = &bytes_handled,
+        .start_ns       = now,
     };
     qemu_co_queue_init(&op->waiting_requests);
 
@@ -488,7 +597,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int64_t max_io_bytes = s->max_io_bytes;
 
     bdrv_graph_co_rdlock();
     source = s->mirror_top_bs->backing->bs;
@@ -600,7 +709,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -866,7 +975,7 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1019,6 +1128,10 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
 
     mirror_free_init(s);
 
+    s->max_in_flight = DEFAULT_IN_FLIGHT;
+    s->max_io_bytes = MAX(s->buf_size / DEFAULT_IN_FLIGHT, MAX_IO_BYTES);
+    mirror_adapt_window_reset(s, qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+
     s->last_pause_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     if (!s->is_none_mode) {
         ret = mirror_dirty_init(s);
@@ -1069,7 +1182,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1297,6 +1410,8 @@ static void mirror_query(BlockJob *job, BlockJobInfo *info)
 
     info->u.mirror = (BlockJobInfoMirror) {
         .actively_synced = qatomic_read(&s->actively_synced),
+        .max_in_flight = qatomic_read(&s->max_in_flight),
+        .chunk_size = qatomic_read(&s->max_io_bytes),
     };
 }
 
@@ -1052,8 +1052,8 @@ static int GRAPH_RDLOCK qcow_make_empty(BlockDriverState *bs)
 /* XXX: put compressed sectors first, then all the cluster aligned
    tables to avoid losing bytes in alignment */
 static int coroutine_fn GRAPH_RDLOCK
-qcow_co_pwritev_compressed(BlockDriverState *bs, int64_t offset, int64_t bytes,
-                           QEMUIOVector *qiov)
+qcow_co_pwritev_compressed_cluster(BlockDriverState *bs, int64_t offset,
+                                   int64_t bytes, QEMUIOVector *qiov)
 {
     BDRVQcowState *s = bs->opaque;
     z_stream strm;
@@ -1134,6 +1134,39 @@ fail:
     return ret;
 }
 
+static int coroutine_fn GRAPH_RDLOCK
+qcow_co_pwritev_compressed(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                           QEMUIOVector *qiov)
+{
+    BDRVQcowState *s = bs->opaque;
+    QEMUIOVector slice;
+    size_t qiov_offset = 0;
+    int ret;
+
+    if (bytes <= s->cluster_size) {
+        return qcow_co_pwritev_compressed_cluster(bs, offset, bytes, qiov);
+    }
+
+    /* Compress multi-cluster requests one cluster at a time */
+    while (bytes) {
+        int64_t chunk_size = MIN(bytes, s->cluster_size);
+
+        qemu_iovec_init_slice(&slice, qiov, qiov_offset, chunk_size);
+        ret = qcow_co_pwritev_compressed_cluster(bs, offset, chunk_size,
+                                                 &slice);
+        qemu_iovec_destroy(&slice);
+        if (ret < 0) {
+            return ret;
+        }
+
+        qiov_offset += chunk_size;
+        offset += chunk_size;
+        bytes -= chunk_size;
+    }
+
+    return 0;
+}
+
 static int coroutine_fn
 qcow_co_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
 {
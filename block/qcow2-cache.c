@@ -25,6 +25,7 @@
 #include "qemu/osdep.h"
 #include "block/block-io.h"
 #include "qemu/memalign.h"
+#include "qemu/xxhash.h"
 #include "qcow2.h"
 #include "trace.h"
 
@@ -33,6 +34,7 @@ typedef struct Qcow2CachedTable {
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    int      hash_next; /* next entry in the same hash bucket, or -1 */
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -44,6 +46,14 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /*
+     * Offset -> entry index lookup. Every entry with a non-zero offset is
+     * linked into the bucket selected by qcow2_cache_hash(), so cache hits
+     * don't have to scan the whole entry array.
+     */
+    int                    *hash_heads;
+    unsigned                hash_mask;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -59,6 +69,53 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline unsigned qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    return qemu_xxhash2(offset / c->table_size) & c->hash_mask;
+}
+
+static int qcow2_cache_hash_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i = c->hash_heads[qcow2_cache_hash(c, offset)];
+
+    while (i != -1 && c->entries[i].offset != offset) {
+        i = c->entries[i].hash_next;
+    }
+    return i;
+}
+
+/*
+ * Change the offset of entry @i, keeping the hash index up to date. An
+ * offset of 0 marks the entry as unused and removes it from the index.
+ */
+static void qcow2_cache_set_offset(Qcow2Cache *c, int i, int64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+    int *p;
+
+    if (t->offset == offset) {
+        return;
+    }
+
+    if (t->offset != 0) {
+        p = &c->hash_heads[qcow2_cache_hash(c, t->offset)];
+        while (*p != i) {
+            assert(*p != -1);
+            p = &c->entries[*p].hash_next;
+        }
+        *p = t->hash_next;
+        t->hash_next = -1;
+    }
+
+    t->offset = offset;
+
+    if (offset != 0) {
+        p = &c->hash_heads[qcow2_cache_hash(c, offset)];
+        t->hash_next = *p;
+        *p = i;
+    }
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -106,7 +163,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
+            qcow2_cache_set_offset(c, i, 0);
             c->entries[i].lru_counter = 0;
             i++;
             to_clean++;
@@ -125,6 +182,8 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    unsigned hash_size;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -138,11 +197,23 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
 
-    if (!c->entries || !c->table_array) {
+    hash_size = pow2ceil(num_tables);
+    c->hash_mask = hash_size - 1;
+    c->hash_heads = g_try_new(int, hash_size);
+
+    if (!c->entries || !c->table_array || !c->hash_heads) {
         qemu_vfree(c->table_array);
+        g_free(c->hash_heads);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    for (i = 0; i < hash_size; i++) {
+        c->hash_heads[i] = -1;
+    }
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].hash_next = -1;
     }
 
     return c;
@@ -157,6 +228,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
     }
 
     qemu_vfree(c->table_array);
+    g_free(c->hash_heads);
     g_free(c->entries);
     g_free(c);
 
@@ -309,7 +381,7 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
+        qcow2_cache_set_offset(c, i, 0);
         c->entries[i].lru_counter = 0;
     }
 
@@ -344,12 +416,15 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     }
 
     /* Check if the table is already cached */
+    i = qcow2_cache_hash_lookup(c, offset);
+    if (i != -1) {
+        goto found;
+    }
+
+    /* Find the least recently used entry that can be replaced */
     i = lookup_index = (offset / c->table_size * 4) % c->size;
     do {
         const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
         if (t->ref == 0 && t->lru_counter < min_lru_counter) {
             min_lru_counter = t->lru_counter;
             min_lru_index = i;
@@ -377,7 +452,7 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -390,7 +465,7 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(c, i, offset);
 
     /* And return the right table */
 found:
@@ -438,14 +513,9 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_hash_lookup(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i == -1 ? NULL : qcow2_cache_get_table_addr(c, i);
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -454,7 +524,7 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     c->entries[i].lru_counter = 0;
     c->entries[i].dirty = false;
 
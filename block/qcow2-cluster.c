@@ -62,6 +62,7 @@ int coroutine_fn qcow2_shrink_l1_table(BlockDriverState *bs,
     }
 
     BLKDBG_CO_EVENT(bs->file, BLKDBG_L1_SHRINK_FREE_L2_CLUSTERS);
+    qcow2_read_map_invalidate(s);
     for (i = s->l1_size - 1; i > new_l1_size - 1; i--) {
         if ((s->l1_table[i] & L1E_OFFSET_MASK) == 0) {
             continue;
@@ -742,6 +743,74 @@ fail:
     return ret;
 }
 
+/*
+ * Remember that @offset is stored in a normal data cluster at @host_offset
+ * so that later reads can use qcow2_get_host_offset_fast().
+ *
+ * The mapping must have been looked up with s->lock held, and the lock must
+ * still be held.
+ */
+void qcow2_read_map_insert(BDRVQcow2State *s, uint64_t offset,
+                           uint64_t host_offset)
+{
+    uint64_t guest_cluster = offset >> s->cluster_bits;
+    Qcow2ReadMapEntry *e =
+        &s->read_map[guest_cluster & (QCOW2_READ_MAP_SIZE - 1)];
+
+    if (has_subclusters(s)) {
+        return;
+    }
+
+    seqlock_write_begin(&s->read_map_lock);
+    e->guest_cluster = guest_cluster;
+    e->host_cluster_offset = start_of_cluster(s, host_offset);
+    e->epoch = s->read_map_epoch;
+    seqlock_write_end(&s->read_map_lock);
+}
+
+/*
+ * Try to translate a read of @bytes at @offset without taking s->lock.
+ *
+ * This only succeeds if the whole range lies within a single normal data
+ * cluster whose mapping is in the read map; *host_offset is then set and the
+ * range can be read like a QCOW2_SUBCLUSTER_NORMAL range returned by
+ * qcow2_get_host_offset(). On failure, the caller must fall back to
+ * qcow2_get_host_offset().
+ */
+bool qcow2_get_host_offset_fast(BlockDriverState *bs, uint64_t offset,
+                                unsigned int bytes, uint64_t *host_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t guest_cluster = offset >> s->cluster_bits;
+    Qcow2ReadMapEntry *e =
+        &s->read_map[guest_cluster & (QCOW2_READ_MAP_SIZE - 1)];
+    uint64_t entry_cluster, entry_host, entry_epoch, epoch;
+    unsigned seq;
+
+    if (has_subclusters(s) ||
+        offset_into_cluster(s, offset) + (uint64_t) bytes > s->cluster_size)
+    {
+        return false;
+    }
+
+    seq = seqlock_read_begin(&s->read_map_lock);
+    entry_cluster = e->guest_cluster;
+    entry_host = e->host_cluster_offset;
+    entry_epoch = e->epoch;
+    epoch = s->read_map_epoch;
+    if (seqlock_read_retry(&s->read_map_lock, seq)) {
+        /* Don't spin, a writer holds s->lock anyway */
+        return false;
+    }
+
+    if (entry_epoch != epoch || entry_cluster != guest_cluster) {
+        return false;
+    }
+
+    *host_offset = entry_host + offset_into_cluster(s, offset);
+    return true;
+}
+
 /*
  * get_cluster_table
  *
@@ -1582,6 +1651,70 @@ out:
     return ret;
 }
 
+/*
+ * Takes up to *nb_clusters clusters from the run that was allocated ahead of
+ * the write stream. If that run is empty, a new one of *nb_clusters plus
+ * s->alloc_batch_clusters clusters is allocated first, so that sequential
+ * writes to new clusters need only one refcount update per batch and end up
+ * contiguous in the image file.
+ *
+ * If *host_offset is not INV_OFFSET, it must be the start of the reserved run.
+ * On return, *host_offset is the start of the clusters taken and
+ * *nb_clusters their number.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+take_reserved_clusters(BlockDriverState *bs, uint64_t *host_offset,
+                       uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->reserved_clusters == 0) {
+        uint64_t n = *nb_clusters + s->alloc_batch_clusters;
+        int64_t cluster_offset;
+
+        assert(*host_offset == INV_OFFSET);
+        cluster_offset = qcow2_alloc_clusters(bs, n * s->cluster_size);
+        if (cluster_offset < 0) {
+            /* Try again without allocating ahead */
+            n = *nb_clusters;
+            cluster_offset = qcow2_alloc_clusters(bs, n * s->cluster_size);
+            if (cluster_offset < 0) {
+                return cluster_offset;
+            }
+        }
+        s->reserved_offset = cluster_offset;
+        s->reserved_clusters = n;
+    }
+
+    assert(*host_offset == INV_OFFSET || *host_offset == s->reserved_offset);
+    *host_offset = s->reserved_offset;
+    *nb_clusters = MIN(*nb_clusters, s->reserved_clusters);
+    s->reserved_offset += *nb_clusters << s->cluster_bits;
+    s->reserved_clusters -= *nb_clusters;
+
+    return 0;
+}
+
+/*
+ * Frees the clusters that were allocated ahead of the write stream but have
+ * not been used yet. This must be called before the image is closed or
+ * inactivated and before anything that expects all allocated clusters to be
+ * referenced (e.g. image checks).
+ */
+void qcow2_release_reserved_clusters(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->reserved_clusters == 0) {
+        return;
+    }
+
+    qcow2_free_clusters(bs, s->reserved_offset,
+                        s->reserved_clusters << s->cluster_bits,
+                        QCOW2_DISCARD_NEVER);
+    s->reserved_clusters = 0;
+}
+
 /*
  * Allocates new clusters for the given guest_offset.
  *
@@ -1619,7 +1752,12 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
 
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
-    if (*host_offset == INV_OFFSET) {
+    if (s->alloc_batch_clusters &&
+        (*host_offset == INV_OFFSET ||
+         (s->reserved_clusters && *host_offset == s->reserved_offset)))
+    {
+        return take_reserved_clusters(bs, host_offset, nb_clusters);
+    } else if (*host_offset == INV_OFFSET) {
         int64_t cluster_offset =
             qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
         if (cluster_offset < 0) {
@@ -876,6 +876,7 @@ int qcow2_snapshot_goto(BlockDriverState *bs, const char *snapshot_id)
     for(i = 0;i < s->l1_size; i++) {
         s->l1_table[i] = be64_to_cpu(sn_l1_table[i]);
     }
+    qcow2_read_map_invalidate(s);
 
     if (ret < 0) {
         goto fail;
@@ -1067,6 +1068,7 @@ int qcow2_snapshot_load_tmp(BlockDriverState *bs,
     s->l1_size = sn->l1_size;
     s->l1_table_offset = sn->l1_table_offset;
     s->l1_table = new_l1_table;
+    qcow2_read_map_invalidate(s);
 
     for(i = 0;i < s->l1_size; i++) {
         be64_to_cpus(&s->l1_table[i]);
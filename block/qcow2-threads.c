@@ -39,13 +39,14 @@
 #include "crypto.h"
 
 static int coroutine_fn
-qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
+qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg,
+                 int max_threads)
 {
     int ret;
     BDRVQcow2State *s = bs->opaque;
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
+    while (s->nb_threads >= max_threads) {
         qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
     }
     s->nb_threads++;
@@ -67,12 +68,14 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
  */
 
 typedef ssize_t (*Qcow2CompressFunc)(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size);
+                                     const void *src, size_t src_size,
+                                     int level);
 typedef struct Qcow2CompressData {
     void *dest;
     size_t dest_size;
     const void *src;
     size_t src_size;
+    int level;
     ssize_t ret;
 
     Qcow2CompressFunc func;
@@ -85,20 +88,22 @@ typedef struct Qcow2CompressData {
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - zlib compression level, 0 for the default
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   int level)
 {
     ssize_t ret;
     z_stream strm;
 
-    /* best compression, small window, no zlib header */
+    /* small window, no zlib header */
     memset(&strm, 0, sizeof(strm));
-    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+    ret = deflateInit2(&strm, level ?: Z_DEFAULT_COMPRESSION, Z_DEFLATED,
                        -12, 9, Z_DEFAULT_STRATEGY);
     if (ret != Z_OK) {
         return -EIO;
@@ -133,12 +138,14 @@ static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - unused
  *
  * Returns: 0 on success
  *          -EIO on fail
  */
 static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size)
+                                     const void *src, size_t src_size,
+                                     int level)
 {
     int ret;
     z_stream strm;
@@ -180,13 +187,15 @@ static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - zstd compression level, 0 for the default
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   int level)
 {
     ssize_t ret;
     size_t zstd_ret;
@@ -205,6 +214,12 @@ static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
     if (!cctx) {
         return -EIO;
     }
+    if (level &&
+        ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                            level))) {
+        ret = -EIO;
+        goto out;
+    }
     /*
      * Use the zstd streamed interface for symmetry with decompression,
      * where streaming is essential since we don't record the exact
@@ -249,12 +264,14 @@ out:
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - unused
  *
  * Returns: 0 on success
  *          -EIO on any error
  */
 static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size)
+                                     const void *src, size_t src_size,
+                                     int level)
 {
     size_t zstd_ret = 0;
     ssize_t ret = 0;
@@ -330,28 +347,52 @@ static int qcow2_compress_pool_func(void *opaque)
     Qcow2CompressData *data = opaque;
 
     data->ret = data->func(data->dest, data->dest_size,
-                           data->src, data->src_size);
+                           data->src, data->src_size, data->level);
 
     return 0;
 }
 
 static ssize_t coroutine_fn
 qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
-                     const void *src, size_t src_size, Qcow2CompressFunc func)
+                     const void *src, size_t src_size, Qcow2CompressFunc func,
+                     int max_threads)
 {
+    BDRVQcow2State *s = bs->opaque;
     Qcow2CompressData arg = {
         .dest = dest,
         .dest_size = dest_size,
         .src = src,
         .src_size = src_size,
+        .level = s->compression_level,
         .func = func,
     };
 
-    qcow2_co_process(bs, qcow2_compress_pool_func, &arg);
+    qcow2_co_process(bs, qcow2_compress_pool_func, &arg, max_threads);
 
     return arg.ret;
 }
 
+/*
+ * qcow2_max_compression_level()
+ *
+ * Returns: the highest compression level that may be configured for
+ *          compression method @type
+ */
+int qcow2_max_compression_level(Qcow2CompressionType type)
+{
+    switch (type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        return Z_BEST_COMPRESSION;
+
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        return ZSTD_maxCLevel();
+#endif
+    default:
+        abort();
+    }
+}
+
 /*
  * qcow2_co_compress()
  *
@@ -385,7 +426,8 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
         abort();
     }
 
-    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
+    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn,
+                                s->max_compress_threads);
 }
 
 /*
@@ -422,7 +464,8 @@ qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
         abort();
     }
 
-    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
+    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn,
+                                QCOW2_MAX_THREADS);
 }
 
 
@@ -475,7 +518,8 @@ qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
     assert(QEMU_IS_ALIGNED(host_offset, sector_size));
     assert(QEMU_IS_ALIGNED(len, sector_size));
 
-    return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
+    return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg,
+                                           QCOW2_MAX_THREADS);
 }
 
 /*
@@ -651,6 +651,7 @@ qcow2_co_check(BlockDriverState *bs, BdrvCheckResult *result,
     int ret;
 
     qemu_co_mutex_lock(&s->lock);
+    qcow2_release_reserved_clusters(bs);
     ret = qcow2_co_check_locked(bs, result, fix);
     qemu_co_mutex_unlock(&s->lock);
     return ret;
@@ -701,6 +702,8 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_ALLOC_BATCH_SIZE,
+    QCOW2_OPT_COMPRESSION_LEVEL,
     NULL
 };
 
@@ -817,6 +820,18 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_ALLOC_BATCH_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Allocate data clusters this far ahead of the write "
+                    "stream (0 to disable)",
+        },
+        {
+            .name = QCOW2_OPT_COMPRESSION_LEVEL,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Compression level for compressed writes (0 for the "
+                    "default of the compression type)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -979,6 +994,8 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    uint64_t alloc_batch_clusters;
+    int compression_level;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -991,6 +1008,8 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t alloc_batch_size;
+    int64_t compression_level;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1032,6 +1051,26 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    alloc_batch_size = qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_BATCH_SIZE, 0);
+    if (alloc_batch_size > 1 * GiB) {
+        error_setg(errp, QCOW2_OPT_ALLOC_BATCH_SIZE " must not exceed 1 GiB");
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->alloc_batch_clusters = size_to_clusters(s, alloc_batch_size);
+
+    /* The option is unsigned, negative values show up as huge numbers */
+    compression_level = qemu_opt_get_number(opts, QCOW2_OPT_COMPRESSION_LEVEL,
+                                            0);
+    if (compression_level < 0 ||
+        compression_level > qcow2_max_compression_level(s->compression_type)) {
+        error_setg(errp, "Compression level must be between 0 and %d",
+                   qcow2_max_compression_level(s->compression_type));
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->compression_level = compression_level;
+
     /* alloc new L2 table/refcount block cache, flush old one */
     if (s->l2_table_cache) {
         ret = qcow2_cache_flush(bs, s->l2_table_cache);
@@ -1230,6 +1269,13 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     s->refcount_block_cache = r->refcount_block_cache;
     s->l2_slice_size = r->l2_slice_size;
 
+    /*
+     * The clusters allocated ahead are freed through the new refcount block
+     * cache, the old one was flushed in the prepare stage.  A new run is
+     * allocated with the new alloc-batch-size on the next write.
+     */
+    qcow2_release_reserved_clusters(bs);
+
     s->overlap_check = r->overlap_check;
     s->use_lazy_refcounts = r->use_lazy_refcounts;
 
@@ -1238,6 +1284,8 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     }
 
     s->discard_no_unref = r->discard_no_unref;
+    s->alloc_batch_clusters = r->alloc_batch_clusters;
+    s->compression_level = r->compression_level;
 
     if (s->cache_clean_interval != r->cache_clean_interval) {
         cache_clean_timer_del(bs);
@@ -1629,6 +1677,10 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     QLIST_INIT(&s->cluster_allocs);
     QTAILQ_INIT(&s->discards);
 
+    /* read_map slots are zeroed and therefore invalid in any epoch but 0 */
+    seqlock_init(&s->read_map_lock);
+    s->read_map_epoch = 1;
+
     /* read qcow2 extensions */
     if (qcow2_read_extensions(bs, header.header_length, ext_end, NULL,
                               flags, &update_header, errp)) {
@@ -1888,6 +1940,11 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    /*
+     * Only compressed writes (qemu-img convert -c, compressing backup) may
+     * use all host CPUs; decompression and encryption keep the usual limit
+     */
+    s->max_compress_threads = MAX(QCOW2_MAX_THREADS, g_get_num_processors());
 
     return ret;
 
@@ -2011,6 +2068,13 @@ qcow2_reopen_prepare(BDRVReopenState *state,BlockReopenQueue *queue,
             goto fail;
         }
 
+        /*
+         * The image can't be written after the commit, so free the clusters
+         * allocated ahead now.  If the reopen is aborted, the next write
+         * simply allocates a new run.
+         */
+        qcow2_release_reserved_clusters(state->bs);
+
         ret = bdrv_flush(state->bs);
         if (ret < 0) {
             goto fail;
@@ -2403,12 +2467,20 @@ qcow2_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                             QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
         }
 
-        qemu_co_mutex_lock(&s->lock);
-        ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
-                                    &host_offset, &type);
-        qemu_co_mutex_unlock(&s->lock);
-        if (ret < 0) {
-            goto out;
+        if (qcow2_get_host_offset_fast(bs, offset, cur_bytes,
+                                       &host_offset)) {
+            type = QCOW2_SUBCLUSTER_NORMAL;
+        } else {
+            qemu_co_mutex_lock(&s->lock);
+            ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
+                                        &host_offset, &type);
+            if (ret == 0 && type == QCOW2_SUBCLUSTER_NORMAL) {
+                qcow2_read_map_insert(s, offset, host_offset);
+            }
+            qemu_co_mutex_unlock(&s->lock);
+            if (ret < 0) {
+                goto out;
+            }
         }
 
         if (type == QCOW2_SUBCLUSTER_ZERO_PLAIN ||
@@ -2762,6 +2834,8 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    qcow2_release_reserved_clusters(bs);
+
     qcow2_store_persistent_dirty_bitmaps(bs, true, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -4321,6 +4395,9 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
 
     qemu_co_mutex_lock(&s->lock);
 
+    /* The clusters allocated ahead may be beyond the new end of the image */
+    qcow2_release_reserved_clusters(bs);
+
     /*
      * Even though we store snapshot size for all images, it was not
      * required until v3, so it is not safe to proceed for v2.
@@ -4905,6 +4982,7 @@ static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
         goto fail_broken_refcounts;
     }
     memset(s->l1_table, 0, l1_size2);
+    qcow2_read_map_invalidate(s);
 
     BLKDBG_EVENT(bs->file, BLKDBG_EMPTY_IMAGE_PREPARE);
 
@@ -5019,6 +5097,8 @@ static int GRAPH_RDLOCK qcow2_make_empty(BlockDriverState *bs)
     int step = QEMU_ALIGN_DOWN(INT_MAX, s->cluster_size);
     int l1_clusters, ret = 0;
 
+    qcow2_release_reserved_clusters(bs);
+
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
 
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
@@ -5534,6 +5614,11 @@ qcow2_downgrade(BlockDriverState *bs, int target_version,
          */
         s->incompatible_features &= ~QCOW2_INCOMPAT_COMPRESSION;
         s->compression_type = QCOW2_COMPRESSION_TYPE_ZLIB;
+        /* A zstd level may be out of range for zlib */
+        if (s->compression_level >
+            qcow2_max_compression_level(s->compression_type)) {
+            s->compression_level = 0;
+        }
     }
 
     assert(s->incompatible_features == 0);
@@ -27,6 +27,7 @@
 
 #include "crypto/block.h"
 #include "qemu/coroutine.h"
+#include "qemu/seqlock.h"
 #include "qemu/units.h"
 #include "block/block_int.h"
 
@@ -150,6 +151,8 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_ALLOC_BATCH_SIZE "alloc-batch-size"
+#define QCOW2_OPT_COMPRESSION_LEVEL "compression-level"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -315,6 +318,20 @@ typedef uint64_t Qcow2GetRefcountFunc(const void *refcount_array,
 typedef void Qcow2SetRefcountFunc(void *refcount_array,
                                   uint64_t index, uint64_t value);
 
+/* Number of slots in the lock-free read mapping cache */
+#define QCOW2_READ_MAP_SIZE 1024
+
+/*
+ * Guest -> host translation of a single allocated data cluster, as cached
+ * for qcow2_get_host_offset_fast(). A slot is only valid if @epoch matches
+ * the current read_map_epoch of the image.
+ */
+typedef struct Qcow2ReadMapEntry {
+    uint64_t guest_cluster;
+    uint64_t host_cluster_offset;
+    uint64_t epoch;
+} Qcow2ReadMapEntry;
+
 typedef struct Qcow2BitmapHeaderExt {
     uint32_t nb_bitmaps;
     uint32_t reserved32;
@@ -350,6 +367,16 @@ typedef struct BDRVQcow2State {
 
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
+    /*
+     * Number of clusters to allocate ahead of the write stream (0 disables
+     * this), and the run of clusters that has been allocated ahead but is not
+     * referenced by any L2 entry yet. These clusters have a refcount of 1 and
+     * show up as leaks if QEMU crashes before they are used or released.
+     */
+    uint64_t alloc_batch_clusters;
+    uint64_t reserved_offset;
+    uint64_t reserved_clusters;
+
     uint64_t *refcount_table;
     uint64_t refcount_table_offset;
     uint32_t refcount_table_size;
@@ -359,6 +386,16 @@ typedef struct BDRVQcow2State {
 
     CoMutex lock;
 
+    /*
+     * Cache of guest -> host mappings of normal data clusters that lets
+     * reads skip s->lock. It is only modified with s->lock held; readers
+     * use read_map_lock to detect concurrent modification. Bumping
+     * read_map_epoch invalidates all slots at once.
+     */
+    QemuSeqLock read_map_lock;
+    uint64_t read_map_epoch;
+    Qcow2ReadMapEntry read_map[QCOW2_READ_MAP_SIZE];
+
     Qcow2CryptoHeaderExtension crypto_header; /* QCow2 header extension */
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
     QCryptoBlock *crypto; /* Disk encryption format driver */
@@ -410,6 +447,7 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int max_compress_threads;
 
     BdrvChild *data_file;
 
@@ -422,6 +460,8 @@ typedef struct BDRVQcow2State {
      * is to convert the image with the desired compression type set.
      */
     Qcow2CompressionType compression_type;
+    /* Level used for compressed writes, 0 for the library default */
+    int compression_level;
 } BDRVQcow2State;
 
 typedef struct Qcow2COWRegion {
@@ -626,10 +666,25 @@ static inline uint64_t get_l2_bitmap(BDRVQcow2State *s, uint64_t *l2_slice,
     }
 }
 
+/*
+ * Drop all cached mappings used by the lock-free read path. Must be called
+ * whenever an existing guest -> host mapping may change.
+ */
+static inline void qcow2_read_map_invalidate(BDRVQcow2State *s)
+{
+    seqlock_write_begin(&s->read_map_lock);
+    s->read_map_epoch++;
+    seqlock_write_end(&s->read_map_lock);
+}
+
 static inline void set_l2_entry(BDRVQcow2State *s, uint64_t *l2_slice,
                                 int idx, uint64_t entry)
 {
     idx *= l2_entry_size(s) / sizeof(uint64_t);
+    /* Unallocated clusters are never in the read map */
+    if (l2_slice[idx] != 0) {
+        qcow2_read_map_invalidate(s);
+    }
     l2_slice[idx] = cpu_to_be64(entry);
 }
 
@@ -638,6 +693,7 @@ static inline void set_l2_bitmap(BDRVQcow2State *s, uint64_t *l2_slice,
 {
     assert(has_subclusters(s));
     idx *= l2_entry_size(s) / sizeof(uint64_t);
+    qcow2_read_map_invalidate(s);
     l2_slice[idx + 1] = cpu_to_be64(bitmap);
 }
 
@@ -924,6 +980,7 @@ int coroutine_fn GRAPH_RDLOCK
 qcow2_shrink_l1_table(BlockDriverState *bs, uint64_t max_size);
 
 int GRAPH_RDLOCK qcow2_write_l1_entry(BlockDriverState *bs, int l1_index);
+void GRAPH_RDLOCK qcow2_release_reserved_clusters(BlockDriverState *bs);
 int qcow2_encrypt_sectors(BDRVQcow2State *s, int64_t sector_num,
                           uint8_t *buf, int nb_sectors, bool enc, Error **errp);
 
@@ -932,6 +989,11 @@ qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
                       unsigned int *bytes, uint64_t *host_offset,
                       QCow2SubclusterType *subcluster_type);
 
+void qcow2_read_map_insert(BDRVQcow2State *s, uint64_t offset,
+                           uint64_t host_offset);
+bool qcow2_get_host_offset_fast(BlockDriverState *bs, uint64_t offset,
+                                unsigned int bytes, uint64_t *host_offset);
+
 int coroutine_fn GRAPH_RDLOCK
 qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
                         unsigned int *bytes, uint64_t *host_offset,
@@ -1058,6 +1120,7 @@ bool qcow2_supports_persistent_dirty_bitmap(BlockDriverState *bs);
 uint64_t qcow2_get_persistent_dirty_bitmap_size(BlockDriverState *bs,
                                                 uint32_t cluster_size);
 
+int qcow2_max_compression_level(Qcow2CompressionType type);
 ssize_t coroutine_fn
 qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
                   const void *src, size_t src_size);
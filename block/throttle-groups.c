@@ -62,6 +62,13 @@ static void timer_cb(ThrottleGroupMember *tgm, ThrottleDirection direction);
  * blk_set_aio_context()). Therefore in this file a thread will
  * access some other ThrottleGroupMember's timers only after verifying that
  * that ThrottleGroupMember has throttled requests in the queue.
+ *
+ * With many members in different AioContexts the lock can become a point of
+ * contention.  If local_cache_ms is set, each member takes that many
+ * milliseconds worth of I/O from the group in advance whenever the group
+ * has capacity left, and admits requests from this local cache without
+ * taking the lock.  A member can thus overrun the group limits by at most
+ * the size of its cache.
  */
 struct ThrottleGroup {
     Object parent_obj;
@@ -76,6 +83,7 @@ struct ThrottleGroup {
     ThrottleGroupMember *tokens[THROTTLE_MAX];
     bool any_timer_armed[THROTTLE_MAX];
     QEMUClockType clock_type;
+    uint32_t local_cache_ms; /* written under lock, read atomically */
 
     /* This field is protected by the global QEMU mutex */
     QTAILQ_ENTRY(ThrottleGroup) list;
@@ -292,6 +300,144 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
     return must_wait;
 }
 
+/*
+ * Admit an I/O request from the local cache of a ThrottleGroupMember, if it
+ * holds enough tokens for it and no earlier request of the same direction
+ * is still waiting in throttled_reqs, which must not be overtaken. The
+ * ThrottleGroup lock is not needed.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @direction: the ThrottleDirection
+ * @ret:       whether the request was admitted
+ */
+static bool throttle_group_cache_take(ThrottleGroupMember *tgm, int64_t bytes,
+                                      ThrottleDirection direction)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    ThrottleGroupCache *cache = &tgm->cache[direction];
+    bool admitted = false;
+    double units;
+
+    if (!qatomic_read(&tg->local_cache_ms) ||
+        qatomic_read(&tgm->pending_reqs[direction])) {
+        return false;
+    }
+
+    qemu_spin_lock(&tgm->cache_lock);
+    units = throttle_op_units(cache->op_size, bytes);
+    if ((cache->bytes < 0 || cache->bytes >= bytes) &&
+        (cache->units < 0 || cache->units >= units) &&
+        (cache->bytes > 0 || cache->units > 0)) {
+        if (cache->bytes > 0) {
+            cache->bytes -= bytes;
+        }
+        if (cache->units > 0) {
+            cache->units -= units;
+        }
+        admitted = true;
+    }
+    qemu_spin_unlock(&tgm->cache_lock);
+
+    return admitted;
+}
+
+/*
+ * Take local_cache_ms worth of I/O from the group and give it to the local
+ * cache of a ThrottleGroupMember, if the group has capacity left right now.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @direction: the ThrottleDirection
+ */
+static void throttle_group_cache_refill(ThrottleGroupMember *tgm,
+                                        ThrottleDirection direction)
+{
+    static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+    };
+    static const BucketType bucket_types_units[THROTTLE_MAX][2] = {
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+    };
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    ThrottleGroupCache *cache = &tgm->cache[direction];
+    ThrottleGroupCache refill = {
+        .bytes = -1,
+        .units = -1,
+        .op_size = ts->cfg.op_size,
+    };
+    unsigned i;
+
+    if (!tg->local_cache_ms || qatomic_read(&tgm->io_limits_disabled) ||
+        tg->any_timer_armed[direction] ||
+        throttle_would_wait(ts, tg->clock_type, direction)) {
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
+        LeakyBucket *bkt = &ts->cfg.buckets[bucket_types_size[direction][i]];
+        int64_t bytes = bkt->avg * tg->local_cache_ms / 1000;
+
+        if (bkt->avg && (refill.bytes < 0 || bytes < refill.bytes)) {
+            refill.bytes = bytes;
+        }
+
+        bkt = &ts->cfg.buckets[bucket_types_units[direction][i]];
+        if (bkt->avg) {
+            double units = (double) bkt->avg * tg->local_cache_ms / 1000;
+            if (refill.units < 0 || units < refill.units) {
+                refill.units = units;
+            }
+        }
+    }
+
+    /* Not worth it if the cache cannot hold a single request */
+    if (refill.bytes == 0 || (refill.units >= 0 && refill.units < 1) ||
+        (refill.bytes < 0 && refill.units < 0)) {
+        return;
+    }
+
+    throttle_account_units(ts, direction, MAX(refill.bytes, 0),
+                           MAX(refill.units, 0));
+
+    qemu_spin_lock(&tgm->cache_lock);
+    /* Keep what is left, it has been accounted already */
+    if (refill.bytes > 0 && cache->bytes > 0) {
+        refill.bytes += cache->bytes;
+    }
+    if (refill.units > 0 && cache->units > 0) {
+        refill.units += cache->units;
+    }
+    *cache = refill;
+    qemu_spin_unlock(&tgm->cache_lock);
+}
+
+/*
+ * Drop the local caches of all members of a group. This is needed whenever
+ * the configuration changes, because the bucket levels are reset then.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg: the ThrottleGroup
+ */
+static void throttle_group_flush_caches(ThrottleGroup *tg)
+{
+    ThrottleGroupMember *tgm;
+    ThrottleDirection dir;
+
+    QLIST_FOREACH(tgm, &tg->head, round_robin) {
+        qemu_spin_lock(&tgm->cache_lock);
+        for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
+            tgm->cache[dir] = (ThrottleGroupCache) { .bytes = 0, .units = 0 };
+        }
+        qemu_spin_unlock(&tgm->cache_lock);
+    }
+}
+
 /* Start the next pending I/O request for a ThrottleGroupMember. Return whether
  * any request was actually pending.
  *
@@ -369,6 +515,10 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     assert(bytes >= 0);
     assert(direction < THROTTLE_MAX);
 
+    if (throttle_group_cache_take(tgm, bytes, direction)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -377,14 +527,14 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[direction]) {
-        tgm->pending_reqs[direction]++;
+        qatomic_inc(&tgm->pending_reqs[direction]);
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[direction],
                            &tgm->throttled_reqs_lock);
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
-        tgm->pending_reqs[direction]--;
+        qatomic_dec(&tgm->pending_reqs[direction]);
     }
 
     /* The I/O will be executed, so do the accounting */
@@ -393,6 +543,9 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* Schedule the next request */
     schedule_next_request(tgm, direction);
 
+    /* Try to admit the next requests without the lock */
+    throttle_group_cache_refill(tgm, direction);
+
     qemu_mutex_unlock(&tg->lock);
 }
 
@@ -478,6 +631,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    throttle_group_flush_caches(tg);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -551,6 +705,8 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     tgm->throttle_state = ts;
     tgm->aio_context = ctx;
     qatomic_set(&tgm->restart_pending, 0);
+    qemu_spin_init(&tgm->cache_lock);
+    memset(tgm->cache, 0, sizeof(tgm->cache));
 
     QEMU_LOCK_GUARD(&tg->lock);
     /* If the ThrottleGroup is new set this ThrottleGroupMember as the token */
@@ -903,6 +1059,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
         goto unlock;
     }
     throttle_config(&tg->ts, tg->clock_type, &cfg);
+    throttle_group_flush_caches(tg);
 
 unlock:
     qemu_mutex_unlock(&tg->lock);
@@ -929,6 +1086,32 @@ static void throttle_group_get_limits(Object *obj, Visitor *v,
     visit_type_ThrottleLimits(v, name, &argp, errp);
 }
 
+static void throttle_group_set_local_cache_ms(Object *obj, Visitor *v,
+                                              const char *name, void *opaque,
+                                              Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&tg->lock);
+    qatomic_set(&tg->local_cache_ms, value);
+    throttle_group_flush_caches(tg);
+}
+
+static void throttle_group_get_local_cache_ms(Object *obj, Visitor *v,
+                                              const char *name, void *opaque,
+                                              Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    uint32_t value = qatomic_read(&tg->local_cache_ms);
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
 static bool throttle_group_can_be_deleted(UserCreatable *uc)
 {
     return OBJECT(uc)->ref == 1;
@@ -958,6 +1141,12 @@ static void throttle_group_obj_class_init(ObjectClass *klass, void *class_data)
                               throttle_group_get_limits,
                               throttle_group_set_limits,
                               NULL, NULL);
+
+    object_class_property_add(klass,
+                              "local-cache-ms", "uint32",
+                              throttle_group_get_local_cache_ms,
+                              throttle_group_set_local_cache_ms,
+                              NULL, NULL);
 }
 
 static const TypeInfo throttle_group_info = {
@@ -1880,6 +1880,7 @@ static void block_dirty_bitmap_add_action(BlockDirtyBitmapAdd *action,
                                action->has_granularity, action->granularity,
                                action->has_persistent, action->persistent,
                                action->has_disabled, action->disabled,
+                               action->has_sparse, action->sparse,
                                &local_err);
 
     if (!local_err) {
@@ -2674,6 +2675,9 @@ static BlockJob *do_backup_common(BackupCommon *backup,
         if (backup->x_perf->has_min_cluster_size) {
             perf.min_cluster_size = backup->x_perf->min_cluster_size;
         }
+        if (backup->x_perf->has_prefetch) {
+            perf.prefetch = backup->x_perf->prefetch;
+        }
     }
 
     if ((backup->sync == MIRROR_SYNC_MODE_BITMAP) ||
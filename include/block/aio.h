@@ -219,6 +219,9 @@ struct AioContext {
 #ifdef CONFIG_LINUX_IO_URING
     LuringState *linux_io_uring;
 
+    /* Ring with big SQEs and CQEs for passthrough commands, created lazily */
+    LuringState *linux_io_uring_cmd;
+
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
@@ -239,6 +242,7 @@ struct AioContext {
 
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
+    bool io_uring_sqpoll;   /* use a kernel submission queue polling thread */
 
     /*
      * List of handlers participating in userspace polling.  Protected by
@@ -517,6 +521,12 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+/* Setup the passthrough command LuringState bound to this AioContext */
+LuringState *aio_setup_linux_io_uring_cmd(AioContext *ctx, Error **errp);
+
+/* Return the passthrough command LuringState bound to this AioContext */
+LuringState *aio_get_linux_io_uring_cmd(AioContext *ctx);
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -716,6 +726,22 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
  */
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
 
+/**
+ * aio_context_set_io_uring_params:
+ * @ctx: the aio context
+ * @sqpoll: whether the Linux io_uring AIO engine lets a kernel thread poll
+ *          its submission queue
+ *
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Fails if the io_uring AIO engine of @ctx has already been set up with a
+ * different setting, the ring is not recreated.
+ *
+ * Returns: true on success, false on failure.
+ */
+bool aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     Error **errp);
+
 /**
  * aio_context_set_thread_pool_params:
  * @ctx: the aio context
@@ -59,10 +59,15 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
  * must be > 0.
  *
  * @max_chunk means maximum length for one IO operation. Zero means unlimited.
+ *
+ * @prefetch makes block-copy look ahead for dirty extents and size requests
+ * according to the amount of dirty data found, so that all workers are kept
+ * busy even when the dirty areas are large and few.
  */
 BlockCopyCallState *block_copy_async(BlockCopyState *s,
                                      int64_t offset, int64_t bytes,
                                      int max_workers, int64_t max_chunk,
+                                     bool prefetch,
                                      BlockCopyAsyncCallbackFunc cb,
                                      void *cb_opaque);
 
@@ -83,6 +88,8 @@ bool block_copy_call_cancelled(BlockCopyCallState *call_state);
 int block_copy_call_status(BlockCopyCallState *call_state, bool *error_is_read);
 
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed);
+/* Bytes per second copied over the last second of copying */
+uint64_t block_copy_throughput(BlockCopyState *s);
 void block_copy_kick(BlockCopyCallState *call_state);
 
 /*
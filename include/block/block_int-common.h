@@ -1048,22 +1048,38 @@ struct BdrvChild {
     QLIST_ENTRY(BdrvChild GRAPH_RDLOCK_PTR) next_parent;
 };
 
+#define BDRV_BSC_MAX_EXTENTS 16
+
 /*
- * Allows bdrv_co_block_status() to cache one data region for a
- * protocol node.
+ * One data region in the block-status cache.
  *
- * @valid: Whether the cache is valid (should be accessed with atomic
+ * @valid: Whether the entry is valid (should be accessed with atomic
  *         functions so this can be reset by RCU readers)
  * @data_start: Offset where we know (or strongly assume) is data
  * @data_end: Offset where the data region ends (which is not necessarily
  *            the start of a zeroed region)
  */
-typedef struct BdrvBlockStatusCache {
-    struct rcu_head rcu;
-
+typedef struct BdrvBlockStatusCacheExtent {
     bool valid;
     int64_t data_start;
     int64_t data_end;
+} BdrvBlockStatusCacheExtent;
+
+/*
+ * Allows bdrv_co_block_status() to cache up to BDRV_BSC_MAX_EXTENTS
+ * non-overlapping data regions for a protocol node, so that callers
+ * which query the status of several areas in turn (e.g. mirror, NBD
+ * clients, qemu-img map) do not go back to the protocol driver every
+ * time they return to a region they have already seen.
+ *
+ * @nb_extents: Number of entries in @extents, oldest first
+ * @extents: The cached data regions
+ */
+typedef struct BdrvBlockStatusCache {
+    struct rcu_head rcu;
+
+    int nb_extents;
+    BdrvBlockStatusCacheExtent extents[BDRV_BSC_MAX_EXTENTS];
 } BdrvBlockStatusCache;
 
 struct BlockDriverState {
@@ -1206,8 +1222,16 @@ struct BlockDriverState {
      * Reading from the list can be done with either the BQL or the
      * dirty_bitmap_mutex.  Modifying a bitmap only requires
      * dirty_bitmap_mutex.
+     *
+     * As an exception, bdrv_set_dirty() does not take the mutex as long as
+     * nobody else holds it.  It announces itself in dirty_bitmap_setters
+     * instead, and whoever takes the mutex sets dirty_bitmap_exclusive and
+     * waits for the running setters to finish.  Both are accessed with
+     * atomics.
      */
     QemuMutex dirty_bitmap_mutex;
+    unsigned dirty_bitmap_setters;
+    bool dirty_bitmap_exclusive;
     QLIST_HEAD(, BdrvDirtyBitmap) dirty_bitmaps;
 
     /* Offset after the highest byte written to */
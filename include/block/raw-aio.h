@@ -18,7 +18,10 @@
 
 #include "block/aio.h"
 #include "block/block-common.h"
+#include "qemu/host-utils.h"
 #include "qemu/iov.h"
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
 
 /* AIO request types */
 #define QEMU_AIO_READ         0x0001
@@ -50,6 +53,123 @@
 #define QEMU_AIO_BLKDEV       0x2000
 #define QEMU_AIO_NO_FALLBACK  0x4000
 
+/*
+ * Statistics of a Linux AIO engine (linux-aio, io_uring) instance, i.e. of
+ * one AioContext.  Only updated from the AioContext home thread, but the
+ * Stat64 fields may be read from any thread.
+ *
+ * Histogram bucket 0 counts the value 0, bucket i counts values in
+ * [2^(i-1), 2^i); the last bucket also counts all larger values.
+ */
+#define AIO_ENGINE_BATCH_BUCKETS   12  /* up to 1024 requests */
+#define AIO_ENGINE_LATENCY_BUCKETS 22  /* up to ~1 s, in microseconds */
+
+/*
+ * Batch size limit for AioContexts without an aio-max-batch setting, see
+ * aio_engine_batch_limit().
+ */
+#define AIO_ENGINE_MIN_BATCH     4
+#define AIO_ENGINE_DEFAULT_BATCH 32
+#define AIO_ENGINE_MAX_BATCH     128
+#define AIO_ENGINE_BATCH_WINDOW  256   /* completions per adjustment */
+
+typedef struct AioEngineStats {
+    Stat64 requests;        /* requests handed to the kernel */
+    Stat64 submissions;     /* io_submit()/io_uring_submit() calls */
+    Stat64 batch_limit;     /* current limit for requests per submission */
+    Stat64 batch_size[AIO_ENGINE_BATCH_BUCKETS];
+    Stat64 latency[AIO_ENGINE_LATENCY_BUCKETS];
+
+    /* Batch limit controller, home thread only */
+    unsigned int limit;         /* 0 until first used */
+    uint64_t win_submissions;   /* submissions in the current window */
+    uint64_t win_full;          /* ... of which were cut by the limit */
+    uint64_t win_completions;
+    uint64_t win_latency_us;    /* sum over the current window */
+    uint64_t prev_latency_us;   /* mean of the previous window */
+} AioEngineStats;
+
+static inline unsigned int aio_engine_stats_bucket(uint64_t value,
+                                                   unsigned int nr_buckets)
+{
+    return MIN(value ? 64 - clz64(value) : 0, nr_buckets - 1);
+}
+
+/*
+ * Return the batch size limit for @in_flight requests in flight.  While few
+ * requests are in flight the device is underutilized, so submitting early
+ * lowers latency.  Beyond that, the limit follows the batch sizes and
+ * completion latency observed over the last AIO_ENGINE_BATCH_WINDOW
+ * completions, see aio_engine_stats_adjust_limit().
+ */
+static inline unsigned int aio_engine_batch_limit(AioEngineStats *stats,
+                                                  unsigned int in_flight)
+{
+    if (!stats->limit) {
+        stats->limit = AIO_ENGINE_DEFAULT_BATCH;
+    }
+    return MIN(MAX(in_flight, AIO_ENGINE_MIN_BATCH), stats->limit);
+}
+
+/*
+ * Grow the limit while most submissions are cut by it, which means the
+ * queue has more requests ready and larger batches would save system calls.
+ * Shrink it as soon as the mean completion latency rises by more than a
+ * quarter, because requests then wait longer in the batch than the saved
+ * system calls are worth.
+ */
+static inline void aio_engine_stats_adjust_limit(AioEngineStats *stats)
+{
+    uint64_t latency_us = stats->win_latency_us / stats->win_completions;
+
+    if (stats->limit) {
+        if (stats->prev_latency_us &&
+            latency_us > stats->prev_latency_us + stats->prev_latency_us / 4) {
+            stats->limit = MAX(stats->limit / 2, AIO_ENGINE_MIN_BATCH);
+        } else if (stats->win_full * 2 > stats->win_submissions) {
+            stats->limit = MIN(stats->limit * 2, AIO_ENGINE_MAX_BATCH);
+        }
+    }
+
+    stats->prev_latency_us = latency_us;
+    stats->win_submissions = 0;
+    stats->win_full = 0;
+    stats->win_completions = 0;
+    stats->win_latency_us = 0;
+}
+
+static inline void aio_engine_stats_submitted(AioEngineStats *stats,
+                                              int nr_requests)
+{
+    stat64_add(&stats->submissions, 1);
+    if (nr_requests > 0) {
+        stat64_add(&stats->requests, nr_requests);
+        stat64_add(&stats->batch_size[
+                       aio_engine_stats_bucket(nr_requests,
+                                               AIO_ENGINE_BATCH_BUCKETS)], 1);
+        stats->win_submissions++;
+        if (nr_requests >= stat64_get(&stats->batch_limit)) {
+            stats->win_full++;
+        }
+    }
+}
+
+/* @submit_ns is the get_clock() value from when the request was queued */
+static inline void aio_engine_stats_completed(AioEngineStats *stats,
+                                              int64_t submit_ns)
+{
+    uint64_t us = (get_clock() - submit_ns) / SCALE_US;
+
+    stat64_add(&stats->latency[
+                   aio_engine_stats_bucket(us, AIO_ENGINE_LATENCY_BUCKETS)],
+               1);
+
+    stats->win_latency_us += us;
+    if (++stats->win_completions == AIO_ENGINE_BATCH_WINDOW) {
+        aio_engine_stats_adjust_limit(stats);
+    }
+}
+
 
 /* linux-aio.c - Linux native implementation */
 #ifdef CONFIG_LINUX_AIO
@@ -66,6 +186,7 @@ bool laio_has_fdsync(int);
 bool laio_has_fua(void);
 void laio_detach_aio_context(LinuxAioState *s, AioContext *old_context);
 void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context);
+AioEngineStats *laio_get_stats(LinuxAioState *s);
 #else
 static inline bool laio_has_fua(void)
 {
@@ -74,15 +195,27 @@ static inline bool laio_has_fua(void)
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(bool sqpoll, bool big_sqe, Error **errp);
 void luring_cleanup(LuringState *s);
 
+/* luring_register_buf: register memory as fixed buffer in all rings */
+void luring_register_buf(void *host, size_t size);
+void luring_unregister_buf(void *host, size_t size);
+
 /* luring_co_submit: submit I/O requests in the thread's current AioContext. */
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type,
                                   BdrvRequestFlags flags);
+#ifdef HAVE_IO_URING_NVME_PASSTHRU
+/* luring_co_submit_cmd: submit IORING_OP_URING_CMD passthrough commands */
+int coroutine_fn luring_co_submit_cmd(BlockDriverState *bs, int fd,
+                                      uint32_t cmd_op, const void *cmd,
+                                      size_t cmd_len);
+bool luring_has_cmd(size_t cmd_len);
+#endif
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
+AioEngineStats *luring_get_stats(LuringState *s);
 bool luring_has_fua(void);
 #else
 static inline bool luring_has_fua(void)
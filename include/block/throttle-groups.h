@@ -26,9 +26,21 @@
 #define THROTTLE_GROUPS_H
 
 #include "qemu/coroutine.h"
+#include "qemu/thread.h"
 #include "qemu/throttle.h"
 #include "qom/object.h"
 
+/*
+ * I/O that a ThrottleGroupMember has already accounted in its group but not
+ * performed yet.  Negative values mean that the respective kind of limit is
+ * not set, so it does not need to be tracked.
+ */
+typedef struct ThrottleGroupCache {
+    int64_t  bytes;
+    double   units;
+    uint64_t op_size;
+} ThrottleGroupCache;
+
 /* The ThrottleGroupMember structure indicates membership in a ThrottleGroup
  * and holds related data.
  */
@@ -49,9 +61,22 @@ typedef struct ThrottleGroupMember {
      */
     unsigned int restart_pending;
 
-    /* The following fields are protected by the ThrottleGroup lock.
+    /*
+     * Tokens taken from the group in advance, so that requests can be
+     * admitted without taking the ThrottleGroup lock.  Only used if the
+     * group has a local-cache-ms setting.  cache_lock protects cache,
+     * and is taken inside the ThrottleGroup lock.
+     */
+    QemuSpin     cache_lock;
+    ThrottleGroupCache cache[THROTTLE_MAX];
+
+    /*
+     * The following fields are protected by the ThrottleGroup lock.
      * See the ThrottleGroup documentation for details.
-     * throttle_state tells us if I/O limits are configured. */
+     * throttle_state tells us if I/O limits are configured.
+     * pending_reqs is also read without the lock by the local cache, so
+     * it is changed with atomic operations.
+     */
     ThrottleState *throttle_state;
     ThrottleTimers throttle_timers;
     unsigned       pending_reqs[THROTTLE_MAX];
@@ -479,6 +479,97 @@ static inline void cpu_physical_memory_clear_dirty_range(ram_addr_t start,
 }
 
 
+/*
+ * Whether [start, start + length) of @rb starts and ends on a word of the
+ * dirty bitmaps, which allows to merge the bitmaps a word at a time.
+ */
+static inline bool cpu_physical_memory_dirty_bitmap_aligned(RAMBlock *rb,
+                                                            ram_addr_t start,
+                                                            ram_addr_t length)
+{
+    unsigned long word = BIT_WORD((start + rb->offset) >> TARGET_PAGE_BITS);
+
+    return ((word * BITS_PER_LONG) << TARGET_PAGE_BITS) ==
+           (start + rb->offset) &&
+           !(length & ((BITS_PER_LONG << TARGET_PAGE_BITS) - 1));
+}
+
+/*
+ * Move the DIRTY_MEMORY_MIGRATION bits of an aligned range into rb->bmap
+ * and return the number of newly dirtied pages. Disjoint ranges may be
+ * merged concurrently; cpu_physical_memory_sync_dirty_bitmap_finish() must
+ * then be called for the range.
+ *
+ * Called with RCU critical section
+ */
+static inline
+uint64_t cpu_physical_memory_merge_dirty_bitmap(RAMBlock *rb,
+                                                ram_addr_t start,
+                                                ram_addr_t length)
+{
+    unsigned long word = BIT_WORD((start + rb->offset) >> TARGET_PAGE_BITS);
+    uint64_t num_dirty = 0;
+    unsigned long *dest = rb->bmap;
+    int k;
+    int nr = BITS_TO_LONGS(length >> TARGET_PAGE_BITS);
+    unsigned long * const *src;
+    unsigned long idx = (word * BITS_PER_LONG) / DIRTY_MEMORY_BLOCK_SIZE;
+    unsigned long offset = BIT_WORD((word * BITS_PER_LONG) %
+                                    DIRTY_MEMORY_BLOCK_SIZE);
+    unsigned long page = BIT_WORD(start >> TARGET_PAGE_BITS);
+
+    src = qatomic_rcu_read(
+            &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
+
+    for (k = page; k < page + nr; k++) {
+        if (src[idx][offset]) {
+            unsigned long bits = qatomic_xchg(&src[idx][offset], 0);
+            unsigned long new_dirty;
+            new_dirty = ~dest[k];
+            dest[k] |= bits;
+            new_dirty &= bits;
+            num_dirty += ctpopl(new_dirty);
+        }
+
+        if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+            offset = 0;
+            idx++;
+        }
+    }
+
+    return num_dirty;
+}
+
+/*
+ * Complete cpu_physical_memory_merge_dirty_bitmap() for a range, given the
+ * number of newly dirtied pages it returned.
+ *
+ * Called with RCU critical section
+ */
+static inline
+void cpu_physical_memory_sync_dirty_bitmap_finish(RAMBlock *rb,
+                                                  ram_addr_t start,
+                                                  ram_addr_t length,
+                                                  uint64_t num_dirty)
+{
+    if (num_dirty) {
+        cpu_physical_memory_dirty_bits_cleared(start, length);
+    }
+
+    if (rb->clear_bmap) {
+        /*
+         * Postpone the dirty bitmap clear to the point before we
+         * really send the pages, also we will split the clear
+         * dirty procedure into smaller chunks.
+         */
+        clear_bmap_set(rb, start >> TARGET_PAGE_BITS,
+                       length >> TARGET_PAGE_BITS);
+    } else {
+        /* Slow path - still do that in a huge chunk */
+        memory_region_clear_dirty_bitmap(rb->mr, start, length);
+    }
+}
+
 /* Called with RCU critical section */
 static inline
 uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
@@ -486,56 +577,14 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
                                                ram_addr_t length)
 {
     ram_addr_t addr;
-    unsigned long word = BIT_WORD((start + rb->offset) >> TARGET_PAGE_BITS);
     uint64_t num_dirty = 0;
     unsigned long *dest = rb->bmap;
 
     /* start address and length is aligned at the start of a word? */
-    if (((word * BITS_PER_LONG) << TARGET_PAGE_BITS) ==
-         (start + rb->offset) &&
-        !(length & ((BITS_PER_LONG << TARGET_PAGE_BITS) - 1))) {
-        int k;
-        int nr = BITS_TO_LONGS(length >> TARGET_PAGE_BITS);
-        unsigned long * const *src;
-        unsigned long idx = (word * BITS_PER_LONG) / DIRTY_MEMORY_BLOCK_SIZE;
-        unsigned long offset = BIT_WORD((word * BITS_PER_LONG) %
-                                        DIRTY_MEMORY_BLOCK_SIZE);
-        unsigned long page = BIT_WORD(start >> TARGET_PAGE_BITS);
-
-        src = qatomic_rcu_read(
-                &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
-
-        for (k = page; k < page + nr; k++) {
-            if (src[idx][offset]) {
-                unsigned long bits = qatomic_xchg(&src[idx][offset], 0);
-                unsigned long new_dirty;
-                new_dirty = ~dest[k];
-                dest[k] |= bits;
-                new_dirty &= bits;
-                num_dirty += ctpopl(new_dirty);
-            }
-
-            if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
-                offset = 0;
-                idx++;
-            }
-        }
-        if (num_dirty) {
-            cpu_physical_memory_dirty_bits_cleared(start, length);
-        }
-
-        if (rb->clear_bmap) {
-            /*
-             * Postpone the dirty bitmap clear to the point before we
-             * really send the pages, also we will split the clear
-             * dirty procedure into smaller chunks.
-             */
-            clear_bmap_set(rb, start >> TARGET_PAGE_BITS,
-                           length >> TARGET_PAGE_BITS);
-        } else {
-            /* Slow path - still do that in a huge chunk */
-            memory_region_clear_dirty_bitmap(rb->mr, start, length);
-        }
+    if (cpu_physical_memory_dirty_bitmap_aligned(rb, start, length)) {
+        num_dirty = cpu_physical_memory_merge_dirty_bitmap(rb, start, length);
+        cpu_physical_memory_sync_dirty_bitmap_finish(rb, start, length,
+                                                     num_dirty);
     } else {
         ram_addr_t offset = rb->offset;
 
@@ -47,6 +47,15 @@ struct RAMBlock {
     /* dirty bitmap used during migration */
     unsigned long *bmap;
 
+    /*
+     * Below fields are only used by the defer-hot-pages capability, on
+     * the source side, and protected by the ram_state.bitmap_mutex
+     */
+    /* bitmap of pages newly dirtied by the last two dirty bitmap syncs */
+    unsigned long *hot_bmap;
+    /* bitmap of pages newly dirtied by the last dirty bitmap sync */
+    unsigned long *last_dirty_bmap;
+
     /*
      * Below fields are only used by mapped-ram migration
      */
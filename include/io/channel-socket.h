@@ -246,6 +246,18 @@ qio_channel_socket_get_remote_address(QIOChannelSocket *ioc,
                                       Error **errp);
 
 
+/**
+ * qio_channel_socket_set_zero_copy:
+ * @ioc: the socket channel object
+ *
+ * Enable SO_ZEROCOPY on the socket and, if the host supports it, set
+ * QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY on @ioc.  Outgoing connections made
+ * with qio_channel_socket_connect_sync() have it enabled already, accepted
+ * connections only get it when their user asks for it.
+ */
+void qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc);
+
+
 /**
  * qio_channel_socket_accept:
  * @ioc: the socket channel object
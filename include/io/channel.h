@@ -975,7 +975,8 @@ int coroutine_mixed_fn qio_channel_writev_full_all(QIOChannel *ioc,
  *
  * Will block until every packet queued with
  * qio_channel_writev_full() + QIO_CHANNEL_WRITE_FLAG_ZERO_COPY
- * is sent, or return in case of any error.
+ * is sent, or return in case of any error.  In coroutine context, the
+ * coroutine yields while waiting instead of blocking the thread.
  *
  * If not implemented, acts as a no-op, and returns 0.
  *
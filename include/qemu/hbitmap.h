@@ -61,6 +61,25 @@ struct HBitmapIter {
  */
 HBitmap *hbitmap_alloc(uint64_t size, int granularity);
 
+/**
+ * hbitmap_alloc_sparse:
+ * @size: Number of bits in the bitmap.
+ * @granularity: Granularity of the bitmap, as for hbitmap_alloc().
+ *
+ * Allocate a new HBitmap that only allocates memory for the bottom level
+ * in regions that have bits set.  This makes it much cheaper for large,
+ * mostly clean bitmaps, at the cost of slightly slower operations.
+ */
+HBitmap *hbitmap_alloc_sparse(uint64_t size, int granularity);
+
+/**
+ * hbitmap_is_sparse:
+ * @hb: HBitmap to operate on.
+ *
+ * Return whether @hb was allocated with hbitmap_alloc_sparse().
+ */
+bool hbitmap_is_sparse(const HBitmap *hb);
+
 /**
  * hbitmap_truncate:
  * @hb: The bitmap to change the size of.
@@ -114,6 +133,21 @@ uint64_t hbitmap_count(const HBitmap *hb);
  */
 void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count);
 
+#if HOST_LONG_BITS == 64
+/**
+ * hbitmap_set_atomic:
+ * @hb: HBitmap to operate on.
+ * @start: First bit to set (0-based).
+ * @count: Number of bits to set.
+ *
+ * Like hbitmap_set(), but may run concurrently with other calls to
+ * hbitmap_set_atomic() on the same bitmap.  It must still be serialized
+ * against all other operations on @hb, including reads.  @hb must not
+ * have a meta bitmap.
+ */
+void hbitmap_set_atomic(HBitmap *hb, uint64_t start, uint64_t count);
+#endif
+
 /**
  * hbitmap_reset:
  * @hb: HBitmap to operate on.
@@ -156,8 +156,15 @@ bool throttle_schedule_timer(ThrottleState *ts,
                              ThrottleTimers *tt,
                              ThrottleDirection direction);
 
+bool throttle_would_wait(ThrottleState *ts, QEMUClockType clock_type,
+                         ThrottleDirection direction);
+
+double throttle_op_units(uint64_t op_size, uint64_t size);
+
 void throttle_account(ThrottleState *ts, ThrottleDirection direction,
                       uint64_t size);
+void throttle_account_units(ThrottleState *ts, ThrottleDirection direction,
+                            uint64_t size, double units);
 void throttle_limits_to_config(ThrottleLimits *arg, ThrottleConfig *cfg,
                                Error **errp);
 void throttle_config_to_limits(ThrottleConfig *cfg, ThrottleLimits *var);
@@ -24,6 +24,7 @@ typedef struct VuFdWatch {
     int fd; /*kick fd*/
     void *pvt;
     vu_watch_cb cb;
+    AioContext *ctx; /* from VuServer->vq_aio_context, NULL for VuServer->ctx */
     QTAILQ_ENTRY(VuFdWatch) next;
 } VuFdWatch;
 
@@ -31,21 +32,25 @@ typedef struct VuFdWatch {
  * VuServer:
  * A vhost-user server instance with user-defined VuDevIface callbacks.
  * Vhost-user device backends can be implemented using VuServer. VuDevIface
- * callbacks and virtqueue kicks run in the given AioContext.
+ * callbacks and virtqueue kicks run in the given AioContext, unless
+ * vq_aio_context assigns a different AioContext to a virtqueue.
  */
 typedef struct {
     QIONetListener *listener;
     QEMUBH *restart_listener_bh;
     AioContext *ctx;
+    AioContext **vq_aio_context; /* per-virtqueue AioContext or NULL */
     int max_queues;
     const VuDevIface *vu_iface;
 
     unsigned int in_flight; /* atomic */
+    bool wait_idle;         /* atomic, see vu_wait_idle() */
 
     /* Protected by ctx lock */
     bool in_qio_channel_yield;
-    bool wait_idle;
     bool quiescing;
+    bool vqs_paused;
+    bool stopping;
     VuDev vu_dev;
     QIOChannel *ioc; /* The I/O channel with the client */
     QIOChannelSocket *sioc; /* The underlying data channel with the client */
@@ -57,6 +62,7 @@ typedef struct {
 bool vhost_user_server_start(VuServer *server,
                              SocketAddress *unix_socket,
                              AioContext *ctx,
+                             AioContext **vq_aio_context,
                              uint16_t max_queues,
                              const VuDevIface *vu_iface,
                              Error **errp);
@@ -21,6 +21,7 @@
 #include "qapi/error.h"
 #include "qapi/qapi-visit-sockets.h"
 #include "qemu/module.h"
+#include "qemu/coroutine.h"
 #include "io/channel-socket.h"
 #include "io/channel-util.h"
 #include "io/channel-watch.h"
@@ -145,6 +146,19 @@ qio_channel_socket_new_fd(int fd,
 }
 
 
+void qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int ret, v = 1;
+    ret = setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
+    if (ret == 0) {
+        /* Zero copy available on host */
+        qio_channel_set_feature(QIO_CHANNEL(ioc),
+                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+    }
+#endif
+}
+
 int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
                                     SocketAddress *addr,
                                     Error **errp)
@@ -164,15 +178,7 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
-#ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
-        /* Zero copy available on host */
-        qio_channel_set_feature(QIO_CHANNEL(ioc),
-                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
-    }
-#endif
+    qio_channel_socket_set_zero_copy(ioc);
 
     qio_channel_set_feature(QIO_CHANNEL(ioc),
                             QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
@@ -725,6 +731,20 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 
 
 #ifdef QEMU_MSG_ZEROCOPY
+/*
+ * Nothing on the errqueue yet.  In a coroutine, running a nested main loop
+ * would stall the AioContext, and the AioContext has no way to wait for
+ * POLLERR alone, so poll the errqueue again a little later.
+ */
+static void coroutine_mixed_fn qio_channel_socket_wait_errqueue(QIOChannel *ioc)
+{
+    if (qemu_in_coroutine()) {
+        qemu_co_sleep_ns(QEMU_CLOCK_REALTIME, 50 * SCALE_US);
+    } else {
+        qio_channel_wait(ioc, G_IO_ERR);
+    }
+}
+
 static int qio_channel_socket_flush(QIOChannel *ioc,
                                     Error **errp)
 {
@@ -752,7 +772,7 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
             switch (errno) {
             case EAGAIN:
                 /* Nothing on errqueue, wait until something is available */
-                qio_channel_wait(ioc, G_IO_ERR);
+                qio_channel_socket_wait_errqueue(ioc);
                 continue;
             case EINTR:
                 continue;
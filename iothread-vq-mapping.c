@@ -8,7 +8,7 @@
 
 #include "qemu/osdep.h"
 #include "system/iothread.h"
-#include "hw/virtio/iothread-vq-mapping.h"
+#include "system/iothread-vq-mapping.h"
 
 static bool
 iothread_vq_mapping_validate(IOThreadVirtQueueMappingList *list, uint16_t
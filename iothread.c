@@ -172,6 +172,11 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
     aio_context_set_aio_params(iothread->ctx,
                                iothread->parent_obj.aio_max_batch);
 
+    if (!aio_context_set_io_uring_params(iothread->ctx,
+                                         iothread->io_uring_sqpoll, errp)) {
+        return;
+    }
+
     aio_context_set_thread_pool_params(iothread->ctx, base->thread_pool_min,
                                        base->thread_pool_max, errp);
 }
@@ -292,6 +297,25 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static bool iothread_get_io_uring_sqpoll(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->io_uring_sqpoll;
+}
+
+static void iothread_set_io_uring_sqpoll(Object *obj, bool value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread->ctx &&
+        !aio_context_set_io_uring_params(iothread->ctx, value, errp)) {
+        return;
+    }
+
+    iothread->io_uring_sqpoll = value;
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_CLASS(klass);
@@ -311,6 +335,9 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add_bool(klass, "io-uring-sqpoll",
+                                   iothread_get_io_uring_sqpoll,
+                                   iothread_set_io_uring_sqpoll);
 }
 
 static const TypeInfo iothread_info = {
@@ -311,6 +311,12 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %" PRIu64 "\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MAX_POSTCOPY_BANDWIDTH),
             params->max_postcopy_bandwidth);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_FAULT_THREADS),
+            params->postcopy_fault_threads);
+        monitor_printf(mon, "%s: %" PRIu64 " bytes\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_PREFETCH_SIZE),
+            params->postcopy_prefetch_size);
         monitor_printf(mon, "%s: '%s'\n",
             MigrationParameter_str(MIGRATION_PARAMETER_TLS_AUTHZ),
             params->tls_authz);
@@ -605,6 +611,14 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_max_postcopy_bandwidth = true;
         visit_type_size(v, param, &p->max_postcopy_bandwidth, &err);
         break;
+    case MIGRATION_PARAMETER_POSTCOPY_FAULT_THREADS:
+        p->has_postcopy_fault_threads = true;
+        visit_type_uint8(v, param, &p->postcopy_fault_threads, &err);
+        break;
+    case MIGRATION_PARAMETER_POSTCOPY_PREFETCH_SIZE:
+        p->has_postcopy_prefetch_size = true;
+        visit_type_size(v, param, &p->postcopy_prefetch_size, &err);
+        break;
     case MIGRATION_PARAMETER_ANNOUNCE_INITIAL:
         p->has_announce_initial = true;
         visit_type_size(v, param, &p->announce_initial, &err);
@@ -486,16 +486,15 @@ static void migrate_generate_event(MigrationStatus new_state)
 
 /*
  * Send a message on the return channel back to the source
- * of the migration.
+ * of the migration.  Must be called with rp_mutex held.
  */
-static int migrate_send_rp_message(MigrationIncomingState *mis,
-                                   enum mig_rp_message_type message_type,
-                                   uint16_t len, void *data)
+static int migrate_send_rp_message_locked(MigrationIncomingState *mis,
+                                          enum mig_rp_message_type message_type,
+                                          uint16_t len, void *data)
 {
     int ret = 0;
 
     trace_migrate_send_rp_message((int)message_type, len);
-    QEMU_LOCK_GUARD(&mis->rp_mutex);
 
     /*
      * It's possible that the file handle got lost due to network
@@ -512,17 +511,27 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
     return qemu_fflush(mis->to_src_file);
 }
 
-/* Request one page from the source VM at the given start address.
+static int migrate_send_rp_message(MigrationIncomingState *mis,
+                                   enum mig_rp_message_type message_type,
+                                   uint16_t len, void *data)
+{
+    QEMU_LOCK_GUARD(&mis->rp_mutex);
+
+    return migrate_send_rp_message_locked(mis, message_type, len, data);
+}
+
+/*
+ * Request pages from the source VM at the given start address.
  *   rb: the RAMBlock to request the page in
  *   Start: Address offset within the RB
  *   Len: Length in bytes required - must be a multiple of pagesize
  */
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start)
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
-    size_t len = qemu_ram_pagesize(rb);
     enum mig_rp_message_type msg_type;
     const char *rbname;
     int rbname_len;
@@ -531,10 +540,11 @@ int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
     *(uint32_t *)(bufc + 8) = cpu_to_be32((uint32_t)len);
 
     /*
-     * We maintain the last ramblock that we requested for page.  Note that we
-     * don't need locking because this function will only be called within the
-     * postcopy ram fault thread.
+     * We maintain the last ramblock that we requested for page.  It is
+     * checked and sent under rp_mutex, as several fault threads may request
+     * pages concurrently.
      */
+    QEMU_LOCK_GUARD(&mis->rp_mutex);
     if (rb != mis->last_rb) {
         mis->last_rb = rb;
 
@@ -551,7 +561,7 @@ int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
         msg_type = MIG_RP_MSG_REQ_PAGES;
     }
 
-    return migrate_send_rp_message(mis, msg_type, msglen, bufc);
+    return migrate_send_rp_message_locked(mis, msg_type, msglen, bufc);
 }
 
 int migrate_send_rp_req_pages(MigrationIncomingState *mis,
@@ -582,7 +592,8 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis,
         return 0;
     }
 
-    return migrate_send_rp_message_req_pages(mis, rb, start);
+    return migrate_send_rp_message_req_pages(mis, rb, start,
+                                             qemu_ram_pagesize(rb));
 }
 
 static bool migration_colo_enabled;
@@ -39,6 +39,7 @@
 #define  MIGRATION_THREAD_DST_COLO          "mig/dst/colo"
 #define  MIGRATION_THREAD_DST_MULTIFD       "mig/dst/recv_%d"
 #define  MIGRATION_THREAD_DST_FAULT         "mig/dst/fault"
+#define  MIGRATION_THREAD_DST_FAULT_WORKER  "mig/dst/fault%u"
 #define  MIGRATION_THREAD_DST_LISTEN        "mig/dst/listen"
 #define  MIGRATION_THREAD_DST_PREEMPT       "mig/dst/preempt"
 
@@ -115,6 +116,15 @@ struct MigrationIncomingState {
     QemuThread     fault_thread;
     /* Set this when we want the fault thread to quit */
     bool           fault_thread_quit;
+    /*
+     * Additional fault threads, see postcopy-fault-threads.  They share
+     * userfault_fd with fault_thread, but leave the pause on network
+     * failures and the shared memory faults to it.
+     */
+    QemuThread    *fault_workers;
+    unsigned int   nr_fault_workers;
+    /* Written once to tell the fault_workers to quit, never consumed */
+    int            fault_workers_quit_fd;
 
     bool           have_listen_thread;
     QemuThread     listen_thread;
@@ -548,7 +558,8 @@ void migrate_send_rp_pong(MigrationIncomingState *mis,
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, RAMBlock *rb,
                               ram_addr_t start, uint64_t haddr);
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start);
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
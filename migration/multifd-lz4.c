@@ -0,0 +1,247 @@
+/*
+ * Multifd lz4 compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "qemu/bswap.h"
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "options.h"
+#include "multifd.h"
+
+/*
+ * Pages are compressed independently so that the receiving side can
+ * decompress them directly into guest memory. The packet data starts with the
+ * big endian compressed size of each page, followed by the compressed pages.
+ * A page that does not compress is sent as is, with a size of one page.
+ */
+struct lz4_data {
+    /* compression state of LZ4_sizeofState() bytes */
+    void *state;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+    /* uncompressed buffer of size qemu_target_page_size() */
+    uint8_t *buf;
+};
+
+static uint32_t multifd_lz4_zbuff_len(void)
+{
+    return multifd_ram_page_count() *
+           (sizeof(uint32_t) + multifd_ram_page_size());
+}
+
+/* Multifd lz4 compression */
+
+static int multifd_lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->state = g_try_malloc(LZ4_sizeofState());
+    z->zbuff_len = multifd_lz4_zbuff_len();
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    z->buf = g_try_malloc(multifd_ram_page_size());
+    if (!z->state || !z->zbuff || !z->buf) {
+        g_free(z->state);
+        g_free(z->zbuff);
+        g_free(z->buf);
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for lz4 buffers", p->id);
+        return -1;
+    }
+    p->compress_data = z;
+
+    /* Needs 2 IOVs, one for packet header and one for compressed data */
+    p->iov = g_new0(struct iovec, 2);
+    return 0;
+}
+
+static void multifd_lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = p->compress_data;
+
+    g_free(z->state);
+    z->state = NULL;
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(z->buf);
+    z->buf = NULL;
+    g_free(p->compress_data);
+    p->compress_data = NULL;
+
+    g_free(p->iov);
+    p->iov = NULL;
+}
+
+static int multifd_lz4_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    struct lz4_data *z = p->compress_data;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t *sizes = (uint32_t *)z->zbuff;
+    uint32_t out_size;
+    uint32_t i;
+
+    if (!multifd_send_prepare_common(p)) {
+        goto out;
+    }
+
+    out_size = pages->normal_num * sizeof(uint32_t);
+    for (i = 0; i < pages->normal_num; i++) {
+        uint8_t *out = z->zbuff + out_size;
+        int ret;
+
+        /*
+         * Since the VM might be running, the page may be changing concurrently
+         * with compression. lz4 does not guarantee that this is safe,
+         * therefore copy the page before compressing it.
+         */
+        memcpy(z->buf, pages->block->host + pages->offset[i], page_size);
+
+        /* Only keep the result if it is smaller than the page */
+        ret = LZ4_compress_fast_extState(z->state, (const char *)z->buf,
+                                         (char *)out, page_size,
+                                         page_size - 1, 1);
+        if (ret <= 0) {
+            memcpy(out, z->buf, page_size);
+            ret = page_size;
+        }
+        sizes[i] = cpu_to_be32(ret);
+        out_size += ret;
+    }
+    p->iov[p->iovs_num].iov_base = z->zbuff;
+    p->iov[p->iovs_num].iov_len = out_size;
+    p->iovs_num++;
+    p->next_packet_size = out_size;
+
+out:
+    p->flags |= MULTIFD_FLAG_LZ4;
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+static int multifd_lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->zbuff_len = multifd_lz4_zbuff_len();
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->compress_data = z;
+    return 0;
+}
+
+static void multifd_lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct lz4_data *z = p->compress_data;
+
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->compress_data);
+    p->compress_data = NULL;
+}
+
+static int multifd_lz4_recv(MultiFDRecvParams *p, Error **errp)
+{
+    struct lz4_data *z = p->compress_data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t *sizes = (uint32_t *)z->zbuff;
+    uint32_t in_pos;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_LZ4) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_LZ4);
+        return -1;
+    }
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        assert(in_size == 0);
+        return 0;
+    }
+
+    in_pos = p->normal_num * sizeof(uint32_t);
+    if (in_size < in_pos || in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %u: invalid packet size %u for %u pages",
+                   p->id, in_size, p->normal_num);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    /* Check all sizes before touching guest memory */
+    for (i = 0; i < p->normal_num; i++) {
+        uint32_t size = be32_to_cpu(sizes[i]);
+
+        if (size > page_size || size > in_size - in_pos) {
+            error_setg(errp, "multifd %u: invalid compressed page size %u",
+                       p->id, size);
+            return -1;
+        }
+        in_pos += size;
+    }
+    if (in_pos != in_size) {
+        error_setg(errp, "multifd %u: packet size received %u size expected %u",
+                   p->id, in_size, in_pos);
+        return -1;
+    }
+
+    in_pos = p->normal_num * sizeof(uint32_t);
+    for (i = 0; i < p->normal_num; i++) {
+        uint32_t size = be32_to_cpu(sizes[i]);
+        char *src = (char *)z->zbuff + in_pos;
+        uint8_t *dst = p->host + p->normal[i];
+
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        if (size == page_size) {
+            memcpy(dst, src, page_size);
+        } else {
+            ret = LZ4_decompress_safe(src, (char *)dst, size, page_size);
+            if (ret != page_size) {
+                error_setg(errp, "multifd %u: lz4 decompression returned %d "
+                           "instead of %u", p->id, ret, page_size);
+                return -1;
+            }
+        }
+        in_pos += size;
+    }
+    return 0;
+}
+
+static const MultiFDMethods multifd_lz4_ops = {
+    .send_setup = multifd_lz4_send_setup,
+    .send_cleanup = multifd_lz4_send_cleanup,
+    .send_prepare = multifd_lz4_send_prepare,
+    .recv_setup = multifd_lz4_recv_setup,
+    .recv_cleanup = multifd_lz4_recv_cleanup,
+    .recv = multifd_lz4_recv
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
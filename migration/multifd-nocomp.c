@@ -75,11 +75,16 @@ static int multifd_nocomp_send_setup(MultiFDSendParams *p, Error **errp)
         p->iov = g_new0(struct iovec, page_count);
     }
 
+    if (migrate_xbzrle()) {
+        return multifd_xbzrle_send_setup(p, errp);
+    }
+
     return 0;
 }
 
 static void multifd_nocomp_send_cleanup(MultiFDSendParams *p, Error **errp)
 {
+    multifd_xbzrle_send_cleanup(p);
     g_free(p->iov);
     p->iov = NULL;
     return;
@@ -128,7 +133,11 @@ static int multifd_nocomp_send_prepare(MultiFDSendParams *p, Error **errp)
         multifd_ram_prepare_header(p);
     }
 
-    multifd_send_prepare_iovs(p);
+    if (multifd_xbzrle_active()) {
+        multifd_xbzrle_send_prepare(p);
+    } else {
+        multifd_send_prepare_iovs(p);
+    }
     p->flags |= MULTIFD_FLAG_NOCOMP;
 
     multifd_send_fill_packet(p);
@@ -155,6 +164,7 @@ static int multifd_nocomp_recv_setup(MultiFDRecvParams *p, Error **errp)
 
 static void multifd_nocomp_recv_cleanup(MultiFDRecvParams *p)
 {
+    multifd_xbzrle_recv_cleanup(p);
     g_free(p->iov);
     p->iov = NULL;
 }
@@ -177,6 +187,10 @@ static int multifd_nocomp_recv(MultiFDRecvParams *p, Error **errp)
 
     multifd_recv_zero_page_process(p);
 
+    if (p->flags & MULTIFD_FLAG_XBZRLE) {
+        return multifd_xbzrle_recv(p, errp);
+    }
+
     if (!p->normal_num) {
         return 0;
     }
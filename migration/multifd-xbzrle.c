@@ -0,0 +1,287 @@
+/*
+ * Multifd XBZRLE encoding
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "qapi/error.h"
+#include "migration-stats.h"
+#include "multifd.h"
+#include "options.h"
+#include "page_cache.h"
+#include "ram.h"
+#include "trace.h"
+#include "xbzrle.h"
+
+/*
+ * Once the first pass over RAM is complete, the send threads encode the
+ * pages against the xbzrle cache. The cache is shared by all channels and
+ * locked per entry, so that the channels encode in parallel.
+ *
+ * A page is sent at most once between two multifd syncs, and the receiving
+ * side applies each delta on top of the page it has received before the
+ * previous sync. The cache thus holds what the destination has, whichever
+ * channel a page was last sent on.
+ *
+ * The packet data starts with the big endian size of each normal page,
+ * followed by the pages: nothing for an unchanged page (size 0), the
+ * encoded delta, or the whole page (size of one page) when it was not
+ * cached or did not encode to less than a page.
+ */
+typedef struct {
+    /* copy of the page being encoded */
+    uint8_t *page;
+    /* a page of zeroes, cached in place of pages sent as zero pages */
+    uint8_t *zero_page;
+    /* packet data */
+    uint8_t *buf;
+} MultiFDXbzrleSend;
+
+static bool multifd_xbzrle_started;
+
+static uint32_t multifd_xbzrle_buf_len(void)
+{
+    return multifd_ram_page_count() *
+           (sizeof(uint32_t) + multifd_ram_page_size());
+}
+
+void multifd_xbzrle_set_started(bool started)
+{
+    qatomic_set(&multifd_xbzrle_started, started);
+}
+
+bool multifd_xbzrle_active(void)
+{
+    return migrate_xbzrle() && qatomic_read(&multifd_xbzrle_started);
+}
+
+int multifd_xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDXbzrleSend *x = g_new0(MultiFDXbzrleSend, 1);
+
+    x->page = g_try_malloc(multifd_ram_page_size());
+    x->zero_page = g_try_malloc0(multifd_ram_page_size());
+    x->buf = g_try_malloc(multifd_xbzrle_buf_len());
+    if (!x->page || !x->zero_page || !x->buf) {
+        g_free(x->page);
+        g_free(x->zero_page);
+        g_free(x->buf);
+        g_free(x);
+        error_setg(errp, "multifd %u: out of memory for xbzrle buffers",
+                   p->id);
+        return -1;
+    }
+    p->compress_data = x;
+    return 0;
+}
+
+void multifd_xbzrle_send_cleanup(MultiFDSendParams *p)
+{
+    MultiFDXbzrleSend *x = p->compress_data;
+
+    if (!x) {
+        return;
+    }
+
+    g_free(x->page);
+    g_free(x->zero_page);
+    g_free(x->buf);
+    g_free(x);
+    p->compress_data = NULL;
+}
+
+/*
+ * Encode page @i of the packet into @out. Returns the number of bytes
+ * written, which is 0 for an unchanged page and the page size for a page
+ * sent as is.
+ */
+static uint32_t multifd_xbzrle_encode_page(MultiFDSendParams *p,
+                                           PageCache *cache, int i,
+                                           uint8_t *out, uint64_t generation,
+                                           XBZRLECacheStats *stats)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    MultiFDXbzrleSend *x = p->compress_data;
+    uint32_t page_size = multifd_ram_page_size();
+    ram_addr_t addr = pages->block->offset + pages->offset[i];
+    uint8_t *host = pages->block->host + pages->offset[i];
+    uint8_t *cached;
+    int len;
+
+    if (!cache) {
+        memcpy(out, host, page_size);
+        return page_size;
+    }
+
+    cache_lock(cache, addr);
+
+    if (!cache_is_cached(cache, addr, generation)) {
+        stats->cache_miss++;
+        /*
+         * Send the copy that is being cached rather than the guest page,
+         * which might change in between.
+         */
+        memcpy(out, host, page_size);
+        cache_insert(cache, addr, out, generation);
+        cache_unlock(cache, addr);
+        return page_size;
+    }
+
+    stats->pages++;
+    cached = get_cached_data(cache, addr);
+    memcpy(x->page, host, page_size);
+
+    /* Only keep the result if it is smaller than the page */
+    len = xbzrle_encode_buffer(cached, x->page, page_size, out, page_size - 1);
+    if (len != 0) {
+        memcpy(cached, x->page, page_size);
+    }
+
+    cache_unlock(cache, addr);
+
+    if (len == 0) {
+        trace_multifd_xbzrle_page_skipping(p->id, addr);
+        return 0;
+    } else if (len < 0) {
+        trace_multifd_xbzrle_page_overflow(p->id, addr);
+        stats->overflow++;
+        stats->bytes += page_size;
+        memcpy(out, x->page, page_size);
+        return page_size;
+    }
+
+    stats->bytes += sizeof(uint32_t) + len;
+    return len;
+}
+
+void multifd_xbzrle_send_prepare(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    MultiFDXbzrleSend *x = p->compress_data;
+    uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
+    uint32_t *sizes = (uint32_t *)x->buf;
+    XBZRLECacheStats stats = { 0 };
+    uint32_t out_size;
+    PageCache *cache;
+    int i;
+
+    RCU_READ_LOCK_GUARD();
+
+    cache = xbzrle_cache_rcu();
+
+    out_size = pages->normal_num * sizeof(uint32_t);
+    for (i = 0; i < pages->normal_num; i++) {
+        uint32_t len = multifd_xbzrle_encode_page(p, cache, i,
+                                                  x->buf + out_size,
+                                                  generation, &stats);
+
+        sizes[i] = cpu_to_be32(len);
+        out_size += len;
+    }
+
+    /*
+     * The destination zeroes the pages, replace any stale copy in the
+     * cache. We don't care if there is no room for a new entry.
+     */
+    for (i = pages->normal_num; cache && i < pages->num; i++) {
+        ram_addr_t addr = pages->block->offset + pages->offset[i];
+
+        cache_lock(cache, addr);
+        cache_insert(cache, addr, x->zero_page, generation);
+        cache_unlock(cache, addr);
+    }
+
+    xbzrle_counters_add(stats.pages, stats.bytes, stats.cache_miss,
+                        stats.overflow);
+
+    p->iov[p->iovs_num].iov_base = x->buf;
+    p->iov[p->iovs_num].iov_len = out_size;
+    p->iovs_num++;
+    p->next_packet_size = out_size;
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+}
+
+int multifd_xbzrle_recv(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t in_pos;
+    uint8_t *buf;
+    int ret;
+    int i;
+
+    if (!p->normal_num) {
+        if (in_size) {
+            error_setg(errp, "multifd %u: unexpected packet size %u",
+                       p->id, in_size);
+            return -1;
+        }
+        return 0;
+    }
+
+    in_pos = p->normal_num * sizeof(uint32_t);
+    if (in_size < in_pos || in_size > multifd_xbzrle_buf_len()) {
+        error_setg(errp, "multifd %u: invalid packet size %u for %u pages",
+                   p->id, in_size, p->normal_num);
+        return -1;
+    }
+
+    /* The source decides to use xbzrle, allocate on first use */
+    if (!p->compress_data) {
+        p->compress_data = g_malloc(multifd_xbzrle_buf_len());
+    }
+    buf = p->compress_data;
+
+    ret = qio_channel_read_all(p->c, (void *)buf, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    /* Check all sizes before touching guest memory */
+    for (i = 0; i < p->normal_num; i++) {
+        uint32_t size = be32_to_cpu(((uint32_t *)buf)[i]);
+
+        if (size > page_size || size > in_size - in_pos) {
+            error_setg(errp, "multifd %u: invalid xbzrle page size %u",
+                       p->id, size);
+            return -1;
+        }
+        in_pos += size;
+    }
+
+    if (in_pos != in_size) {
+        error_setg(errp, "multifd %u: packet size received %u size expected %u",
+                   p->id, in_size, in_pos);
+        return -1;
+    }
+
+    in_pos = p->normal_num * sizeof(uint32_t);
+    for (i = 0; i < p->normal_num; i++) {
+        uint32_t size = be32_to_cpu(((uint32_t *)buf)[i]);
+        uint8_t *src = buf + in_pos;
+        uint8_t *dst = p->host + p->normal[i];
+
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        if (size == page_size) {
+            memcpy(dst, src, page_size);
+        } else if (size && xbzrle_decode_buffer(src, size, dst,
+                                                page_size) < 0) {
+            error_setg(errp, "multifd %u: failed to decode xbzrle page",
+                       p->id);
+            return -1;
+        }
+        in_pos += size;
+    }
+    return 0;
+}
+
+void multifd_xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    g_free(p->compress_data);
+    p->compress_data = NULL;
+}
@@ -58,6 +58,7 @@ MultiFDRecvData *multifd_get_recv_data(void);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_LZ4 (3 << 1)
 #define MULTIFD_FLAG_QPL (4 << 1)
 #define MULTIFD_FLAG_UADK (8 << 1)
 #define MULTIFD_FLAG_QATZIP (16 << 1)
@@ -68,6 +69,12 @@ MultiFDRecvData *multifd_get_recv_data(void);
  */
 #define MULTIFD_FLAG_DEVICE_STATE (32 << 1)
 
+/*
+ * If set it means that the normal pages of this packet are XBZRLE encoded
+ * against the previous version of the pages.
+ */
+#define MULTIFD_FLAG_XBZRLE (64 << 1)
+
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
 
@@ -403,6 +410,14 @@ void multifd_ram_payload_free(MultiFDPages_t *pages);
 void multifd_ram_fill_packet(MultiFDSendParams *p);
 int multifd_ram_unfill_packet(MultiFDRecvParams *p, Error **errp);
 
+void multifd_xbzrle_set_started(bool started);
+bool multifd_xbzrle_active(void);
+int multifd_xbzrle_send_setup(MultiFDSendParams *p, Error **errp);
+void multifd_xbzrle_send_cleanup(MultiFDSendParams *p);
+void multifd_xbzrle_send_prepare(MultiFDSendParams *p);
+int multifd_xbzrle_recv(MultiFDRecvParams *p, Error **errp);
+void multifd_xbzrle_recv_cleanup(MultiFDRecvParams *p);
+
 void multifd_send_data_clear_device_state(MultiFDDeviceState_t *device_state);
 
 void multifd_device_state_send_setup(void);
@@ -53,6 +53,8 @@
 /* The delay time (in ms) between two COLO checkpoints */
 #define DEFAULT_MIGRATE_X_CHECKPOINT_DELAY (200 * 100)
 #define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
+#define DEFAULT_MIGRATE_POSTCOPY_FAULT_THREADS 1
+#define MAX_MIGRATE_POSTCOPY_PREFETCH_SIZE (64 * 1024 * 1024)
 #define DEFAULT_MIGRATE_MULTIFD_COMPRESSION MULTIFD_COMPRESSION_NONE
 /* 0: means nocompress, 1: best speed, ... 9: best compress ratio */
 #define DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL 1
@@ -147,6 +149,11 @@ const Property migration_properties[] = {
     DEFINE_PROP_SIZE("max-postcopy-bandwidth", MigrationState,
                       parameters.max_postcopy_bandwidth,
                       DEFAULT_MIGRATE_MAX_POSTCOPY_BANDWIDTH),
+    DEFINE_PROP_UINT8("postcopy-fault-threads", MigrationState,
+                      parameters.postcopy_fault_threads,
+                      DEFAULT_MIGRATE_POSTCOPY_FAULT_THREADS),
+    DEFINE_PROP_SIZE("postcopy-prefetch-size", MigrationState,
+                      parameters.postcopy_prefetch_size, 0),
     DEFINE_PROP_UINT8("max-cpu-throttle", MigrationState,
                       parameters.max_cpu_throttle,
                       DEFAULT_MIGRATE_MAX_CPU_THROTTLE),
@@ -201,6 +208,8 @@ const Property migration_properties[] = {
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-defer-hot-pages",
+                        MIGRATION_CAPABILITY_DEFER_HOT_PAGES),
 };
 const size_t migration_properties_count = ARRAY_SIZE(migration_properties);
 
@@ -232,6 +241,13 @@ bool migrate_colo(void)
     return s->capabilities[MIGRATION_CAPABILITY_X_COLO];
 }
 
+bool migrate_defer_hot_pages(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_DEFER_HOT_PAGES];
+}
+
 bool migrate_dirty_bitmaps(void)
 {
     MigrationState *s = migrate_get_current();
@@ -441,7 +457,8 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_XBZRLE,
     MIGRATION_CAPABILITY_X_COLO,
     MIGRATION_CAPABILITY_VALIDATE_UUID,
-    MIGRATION_CAPABILITY_ZERO_COPY_SEND);
+    MIGRATION_CAPABILITY_ZERO_COPY_SEND,
+    MIGRATION_CAPABILITY_DEFER_HOT_PAGES);
 
 static bool migrate_incoming_started(void)
 {
@@ -590,11 +607,12 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
-    if (new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
-        if (new_caps[MIGRATION_CAPABILITY_XBZRLE]) {
-            error_setg(errp, "Multifd is not compatible with xbzrle");
-            return false;
-        }
+    if (new_caps[MIGRATION_CAPABILITY_MULTIFD] &&
+        new_caps[MIGRATION_CAPABILITY_XBZRLE] &&
+        migrate_multifd_compression()) {
+        error_setg(errp,
+                   "Multifd xbzrle only available for non-compressed multifd migration");
+        return false;
     }
 
     if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
@@ -755,6 +773,20 @@ uint64_t migrate_max_postcopy_bandwidth(void)
     return s->parameters.max_postcopy_bandwidth;
 }
 
+uint8_t migrate_postcopy_fault_threads(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.postcopy_fault_threads;
+}
+
+uint64_t migrate_postcopy_prefetch_size(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.postcopy_prefetch_size;
+}
+
 MigMode migrate_mode(void)
 {
     MigMode mode = cpr_get_incoming_mode();
@@ -937,6 +969,10 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->zero_page_detection = s->parameters.zero_page_detection;
     params->has_direct_io = true;
     params->direct_io = s->parameters.direct_io;
+    params->has_postcopy_fault_threads = true;
+    params->postcopy_fault_threads = s->parameters.postcopy_fault_threads;
+    params->has_postcopy_prefetch_size = true;
+    params->postcopy_prefetch_size = s->parameters.postcopy_prefetch_size;
 
     return params;
 }
@@ -971,6 +1007,8 @@ void migrate_params_init(MigrationParameters *params)
     params->has_mode = true;
     params->has_zero_page_detection = true;
     params->has_direct_io = true;
+    params->has_postcopy_fault_threads = true;
+    params->has_postcopy_prefetch_size = true;
 }
 
 /*
@@ -1043,6 +1081,22 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_postcopy_fault_threads &&
+        params->postcopy_fault_threads < 1) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "postcopy_fault_threads",
+                   "a value between 1 and 255");
+        return false;
+    }
+
+    if (params->has_postcopy_prefetch_size &&
+        params->postcopy_prefetch_size > MAX_MIGRATE_POSTCOPY_PREFETCH_SIZE) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "postcopy_prefetch_size",
+                   "a value between 0 and 64 MiB");
+        return false;
+    }
+
     if (params->has_multifd_zlib_level &&
         (params->multifd_zlib_level > 9)) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_zlib_level",
@@ -1129,6 +1183,13 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
     }
 #endif
 
+    if (migrate_multifd() && migrate_xbzrle() &&
+        params->has_multifd_compression && params->multifd_compression) {
+        error_setg(errp,
+                   "Multifd xbzrle only available for non-compressed multifd migration");
+        return false;
+    }
+
     if (migrate_mapped_ram() &&
         (migrate_multifd_compression() || migrate_tls())) {
         error_setg(errp,
@@ -1270,6 +1331,14 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_direct_io) {
         dest->direct_io = params->direct_io;
     }
+
+    if (params->has_postcopy_fault_threads) {
+        dest->postcopy_fault_threads = params->postcopy_fault_threads;
+    }
+
+    if (params->has_postcopy_prefetch_size) {
+        dest->postcopy_prefetch_size = params->postcopy_prefetch_size;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
@@ -1402,6 +1471,14 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_direct_io) {
         s->parameters.direct_io = params->direct_io;
     }
+
+    if (params->has_postcopy_fault_threads) {
+        s->parameters.postcopy_fault_threads = params->postcopy_fault_threads;
+    }
+
+    if (params->has_postcopy_prefetch_size) {
+        s->parameters.postcopy_prefetch_size = params->postcopy_prefetch_size;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
@@ -27,6 +27,7 @@ extern const size_t migration_properties_count;
 
 bool migrate_auto_converge(void);
 bool migrate_colo(void);
+bool migrate_defer_hot_pages(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_events(void);
 bool migrate_mapped_ram(void);
@@ -74,6 +75,8 @@ uint8_t migrate_max_cpu_throttle(void);
 uint64_t migrate_max_bandwidth(void);
 uint64_t migrate_avail_switchover_bandwidth(void);
 uint64_t migrate_max_postcopy_bandwidth(void);
+uint8_t migrate_postcopy_fault_threads(void);
+uint64_t migrate_postcopy_prefetch_size(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
 int migrate_multifd_zlib_level(void);
@@ -17,12 +17,17 @@
 #include "qapi/qmp/qerror.h"
 #include "qapi/error.h"
 #include "qemu/host-utils.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
 #include "page_cache.h"
 #include "trace.h"
 
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/* number of locks, each protecting an interleaved subset of the items */
+#define CACHE_LOCKS 64
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
@@ -32,10 +37,12 @@ struct CacheItem {
 };
 
 struct PageCache {
+    struct rcu_head rcu;
     CacheItem *page_cache;
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
+    QemuMutex locks[CACHE_LOCKS];
 };
 
 PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
@@ -58,7 +65,7 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
     }
 
     /* We prefer not to abort if there is no memory */
-    cache = g_try_malloc(sizeof(*cache));
+    cache = g_try_malloc0(sizeof(*cache));
     if (!cache) {
         error_setg(errp, "Failed to allocate cache");
         return NULL;
@@ -84,6 +91,10 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
         cache->page_cache[i].it_addr = -1;
     }
 
+    for (i = 0; i < CACHE_LOCKS; i++) {
+        qemu_mutex_init(&cache->locks[i]);
+    }
+
     return cache;
 }
 
@@ -98,11 +109,20 @@ void cache_fini(PageCache *cache)
         g_free(cache->page_cache[i].it_data);
     }
 
+    for (i = 0; i < CACHE_LOCKS; i++) {
+        qemu_mutex_destroy(&cache->locks[i]);
+    }
+
     g_free(cache->page_cache);
     cache->page_cache = NULL;
     g_free(cache);
 }
 
+void cache_fini_rcu(PageCache *cache)
+{
+    call_rcu(cache, cache_fini, rcu);
+}
+
 static size_t cache_get_cache_pos(const PageCache *cache,
                                   uint64_t address)
 {
@@ -110,6 +130,21 @@ static size_t cache_get_cache_pos(const PageCache *cache,
     return (address / cache->page_size) & (cache->max_num_items - 1);
 }
 
+static QemuMutex *cache_get_lock(PageCache *cache, uint64_t addr)
+{
+    return &cache->locks[cache_get_cache_pos(cache, addr) % CACHE_LOCKS];
+}
+
+void cache_lock(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_lock(cache_get_lock(cache, addr));
+}
+
+void cache_unlock(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_unlock(cache_get_lock(cache, addr));
+}
+
 static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
 {
     size_t pos;
@@ -163,7 +198,7 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
             trace_migration_pagecache_insert();
             return -1;
         }
-        cache->num_items++;
+        qatomic_inc(&cache->num_items);
     }
 
     memcpy(it->it_data, pdata, cache->page_size);
@@ -35,6 +35,37 @@ PageCache *cache_init(uint64_t cache_size, size_t page_size, Error **errp);
  */
 void cache_fini(PageCache *cache);
 
+/**
+ * cache_fini_rcu: free all cache resources after an RCU grace period
+ *
+ * Use this instead of cache_fini() when other threads may still access
+ * the cache within an RCU read-side critical section.
+ *
+ * @cache pointer to the PageCache struct
+ */
+void cache_fini_rcu(PageCache *cache);
+
+/**
+ * cache_lock: lock the cache entry that an address maps to
+ *
+ * The cache is not thread-safe by itself. Threads that access the cache
+ * concurrently must hold the lock of an address across all the calls that
+ * look up, read or update its entry. Addresses that map to different
+ * entries can be accessed in parallel.
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page address
+ */
+void cache_lock(PageCache *cache, uint64_t addr);
+
+/**
+ * cache_unlock: unlock the cache entry locked by cache_lock()
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page address
+ */
+void cache_unlock(PageCache *cache, uint64_t addr);
+
 /**
  * cache_is_cached: Checks to see if the page is cached
  *
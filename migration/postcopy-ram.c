@@ -586,6 +586,29 @@ static void postcopy_temp_pages_cleanup(MigrationIncomingState *mis)
     }
 }
 
+static void postcopy_fault_workers_cleanup(MigrationIncomingState *mis)
+{
+    uint64_t tmp64 = 1;
+    unsigned int i;
+
+    if (!mis->fault_workers) {
+        return;
+    }
+
+    /* The event is never consumed, so it wakes up all the workers */
+    if (write(mis->fault_workers_quit_fd, &tmp64, 8) != 8) {
+        error_report("%s: write() failed", __func__);
+    }
+    for (i = 0; i < mis->nr_fault_workers; i++) {
+        qemu_thread_join(&mis->fault_workers[i]);
+    }
+
+    close(mis->fault_workers_quit_fd);
+    g_free(mis->fault_workers);
+    mis->fault_workers = NULL;
+    mis->nr_fault_workers = 0;
+}
+
 /*
  * At the end of a migration where postcopy_ram_incoming_init was called.
  */
@@ -630,10 +653,11 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
     if (mis->have_fault_thread) {
         Error *local_err = NULL;
 
-        /* Let the fault thread quit */
+        /* Let the fault threads quit */
         qatomic_set(&mis->fault_thread_quit, 1);
         postcopy_fault_thread_notify(mis);
         trace_postcopy_ram_incoming_cleanup_join();
+        postcopy_fault_workers_cleanup(mis);
         qemu_thread_join(&mis->fault_thread);
 
         if (postcopy_notify(POSTCOPY_NOTIFY_INBOUND_END, &local_err)) {
@@ -950,12 +974,161 @@ static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
     trace_postcopy_pause_fault_thread_continued();
 }
 
+/*
+ * State of the adaptive prefetch for one faulting thread.  The window is the
+ * number of host pages requested after a faulting page.  It doubles each
+ * time the thread faults close to its previous fault, which is what a
+ * sequential access looks like once the pages that were prefetched don't
+ * fault anymore, and it halves on any other fault.
+ *
+ * All fault threads read the same userfaultfd, so each of them sees the
+ * faults of many vCPUs interleaved.  The state is therefore kept per
+ * faulting thread (ptid), in a small direct-mapped table per fault thread.
+ * Without UFFD_FEATURE_THREAD_ID, all faults share one entry.
+ */
+typedef struct PostcopyPrefetch {
+    uint32_t ptid;
+    RAMBlock *last_rb;
+    ram_addr_t last_offset;
+    uint64_t window;
+} PostcopyPrefetch;
+
+#define POSTCOPY_PREFETCH_SLOTS 16
+
+/*
+ * Request the pages following the faulting page at @offset in @rb, if the
+ * faults of the thread @ptid look sequential.  @table has
+ * POSTCOPY_PREFETCH_SLOTS entries.
+ */
+static void postcopy_prefetch_pages(MigrationIncomingState *mis,
+                                    PostcopyPrefetch *table, RAMBlock *rb,
+                                    ram_addr_t offset, uint32_t ptid)
+{
+    PostcopyPrefetch *pf = &table[ptid % POSTCOPY_PREFETCH_SLOTS];
+    size_t pagesize = qemu_ram_pagesize(rb);
+    uint64_t max_window = migrate_postcopy_prefetch_size() / pagesize;
+    ram_addr_t start = offset + pagesize;
+    ram_addr_t distance, end, len;
+
+    /*
+     * With postcopy-preempt, the source sends requested pages on the
+     * urgent path one range at a time, so a prefetch request would hold up
+     * the faults of other vCPUs that are queued behind it.
+     */
+    if (!max_window || migrate_postcopy_preempt()) {
+        return;
+    }
+
+    if (pf->ptid != ptid) {
+        *pf = (PostcopyPrefetch) { .ptid = ptid };
+    }
+
+    distance = offset > pf->last_offset ? offset - pf->last_offset :
+                                          pf->last_offset - offset;
+    if (rb == pf->last_rb && distance <= (pf->window + 1) * pagesize) {
+        pf->window = pf->window ? MIN(pf->window * 2, max_window) : 1;
+    } else {
+        pf->window /= 2;
+    }
+    pf->last_rb = rb;
+    pf->last_offset = offset;
+
+    if (!pf->window || start >= rb->used_length) {
+        return;
+    }
+
+    /* Stop at the first page that is there or that is not migrated */
+    end = MIN(start + pf->window * pagesize, rb->used_length);
+    for (len = 0; start + len < end; len += pagesize) {
+        if (ramblock_recv_bitmap_test_byte_offset(rb, start + len) ||
+            ramblock_page_is_discarded(rb, start + len)) {
+            break;
+        }
+    }
+    if (!len) {
+        return;
+    }
+
+    trace_postcopy_prefetch_pages(qemu_ram_get_idstr(rb), start, len,
+                                  pf->window);
+    /*
+     * No vCPU waits on these pages yet, so they are not tracked in the page
+     * request tree and are simply lost if the return path fails.
+     */
+    migrate_send_rp_message_req_pages(mis, rb, start, len);
+}
+
+/*
+ * Read a message from the userfaultfd @ufd.  Returns 1 for a page fault,
+ * 0 if there is nothing to handle, and -1 if the fd can't be read anymore.
+ */
+static int postcopy_fault_read(int ufd, struct uffd_msg *msg)
+{
+    int ret = read(ufd, msg, sizeof(*msg));
+
+    if (ret != sizeof(*msg)) {
+        if (errno == EAGAIN) {
+            /*
+             * if a wake up happens on the other thread just after
+             * the poll, there is nothing to read.
+             */
+            return 0;
+        }
+        if (ret < 0) {
+            error_report("%s: Failed to read full userfault "
+                         "message: %s",
+                         __func__, strerror(errno));
+        } else {
+            error_report("%s: Read %d bytes from userfaultfd "
+                         "expected %zd",
+                         __func__, ret, sizeof(*msg));
+            /* Lost alignment, don't know what we'd read next */
+        }
+        return -1;
+    }
+    if (msg->event != UFFD_EVENT_PAGEFAULT) {
+        error_report("%s: Read unexpected event %ud from userfaultfd",
+                     __func__, msg->event);
+        return 0; /* It's not a page fault, shouldn't happen */
+    }
+    return 1;
+}
+
+/*
+ * Find the RAMBlock and host page offset of the page fault @msg, and start
+ * accounting the blocktime of the faulting vCPU.  Returns NULL if the fault
+ * is outside guest memory.
+ */
+static RAMBlock *postcopy_fault_begin(struct uffd_msg *msg,
+                                      ram_addr_t *rb_offset)
+{
+    RAMBlock *rb;
+
+    rb = qemu_ram_block_from_host((void *)(uintptr_t)msg->arg.pagefault.address,
+                                  true, rb_offset);
+    if (!rb) {
+        error_report("%s: Fault outside guest: %" PRIx64, __func__,
+                     (uint64_t)msg->arg.pagefault.address);
+        return NULL;
+    }
+
+    *rb_offset = ROUND_DOWN(*rb_offset, qemu_ram_pagesize(rb));
+    trace_postcopy_ram_fault_thread_request(msg->arg.pagefault.address,
+                                            qemu_ram_get_idstr(rb),
+                                            *rb_offset,
+                                            msg->arg.pagefault.feat.ptid);
+    mark_postcopy_blocktime_begin((uintptr_t)(msg->arg.pagefault.address),
+                                  msg->arg.pagefault.feat.ptid, rb);
+    return rb;
+}
+
 /*
  * Handle faults detected by the USERFAULT markings
  */
 static void *postcopy_ram_fault_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    PostcopyPrefetch pf[POSTCOPY_PREFETCH_SLOTS] = {};
     struct uffd_msg msg;
     int ret;
     size_t index;
@@ -1027,51 +1200,18 @@ static void *postcopy_ram_fault_thread(void *opaque)
 
         if (pfd[0].revents) {
             poll_result--;
-            ret = read(mis->userfault_fd, &msg, sizeof(msg));
-            if (ret != sizeof(msg)) {
-                if (errno == EAGAIN) {
-                    /*
-                     * if a wake up happens on the other thread just after
-                     * the poll, there is nothing to read.
-                     */
-                    continue;
-                }
-                if (ret < 0) {
-                    error_report("%s: Failed to read full userfault "
-                                 "message: %s",
-                                 __func__, strerror(errno));
-                    break;
-                } else {
-                    error_report("%s: Read %d bytes from userfaultfd "
-                                 "expected %zd",
-                                 __func__, ret, sizeof(msg));
-                    break; /* Lost alignment, don't know what we'd read next */
-                }
-            }
-            if (msg.event != UFFD_EVENT_PAGEFAULT) {
-                error_report("%s: Read unexpected event %ud from userfaultfd",
-                             __func__, msg.event);
-                continue; /* It's not a page fault, shouldn't happen */
+            ret = postcopy_fault_read(mis->userfault_fd, &msg);
+            if (ret < 0) {
+                break;
+            } else if (ret == 0) {
+                continue;
             }
 
-            rb = qemu_ram_block_from_host(
-                     (void *)(uintptr_t)msg.arg.pagefault.address,
-                     true, &rb_offset);
+            rb = postcopy_fault_begin(&msg, &rb_offset);
             if (!rb) {
-                error_report("postcopy_ram_fault_thread: Fault outside guest: %"
-                             PRIx64, (uint64_t)msg.arg.pagefault.address);
                 break;
             }
 
-            rb_offset = ROUND_DOWN(rb_offset, qemu_ram_pagesize(rb));
-            trace_postcopy_ram_fault_thread_request(msg.arg.pagefault.address,
-                                                qemu_ram_get_idstr(rb),
-                                                rb_offset,
-                                                msg.arg.pagefault.feat.ptid);
-            mark_postcopy_blocktime_begin(
-                    (uintptr_t)(msg.arg.pagefault.address),
-                                msg.arg.pagefault.feat.ptid, rb);
-
 retry:
             /*
              * Send the request to the source - we want to request one
@@ -1084,6 +1224,8 @@ retry:
                 postcopy_pause_fault_thread(mis);
                 goto retry;
             }
+            postcopy_prefetch_pages(mis, pf, rb, rb_offset,
+                                    msg.arg.pagefault.feat.ptid);
         }
 
         /* Now handle any requests from external processes on shared memory */
@@ -1148,6 +1290,98 @@ retry:
     return NULL;
 }
 
+/*
+ * Additional fault thread, only handling the faults on userfault_fd
+ */
+static void *postcopy_ram_fault_worker(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    PostcopyPrefetch pf[POSTCOPY_PREFETCH_SLOTS] = {};
+    struct pollfd pfd[2] = {
+        { .fd = mis->userfault_fd, .events = POLLIN },
+        { .fd = mis->fault_workers_quit_fd, .events = POLLIN },
+    };
+    struct uffd_msg msg;
+    ram_addr_t rb_offset;
+    RAMBlock *rb;
+    int ret;
+
+    trace_postcopy_ram_fault_worker_entry();
+    rcu_register_thread();
+    qemu_sem_post(&mis->thread_sync_sem);
+
+    while (true) {
+        if (poll(pfd, ARRAY_SIZE(pfd), -1 /* Wait forever */) == -1) {
+            error_report("%s: userfault poll: %s", __func__, strerror(errno));
+            break;
+        }
+
+        if (pfd[1].revents) {
+            break;
+        }
+
+        if (!pfd[0].revents) {
+            continue;
+        }
+
+        ret = postcopy_fault_read(mis->userfault_fd, &msg);
+        if (ret < 0) {
+            break;
+        } else if (ret == 0) {
+            continue;
+        }
+
+        rb = postcopy_fault_begin(&msg, &rb_offset);
+        if (!rb) {
+            break;
+        }
+
+        /*
+         * Unlike the main fault thread, don't wait for a recovery if the
+         * request can't be sent: it is kept in the page request tree, and
+         * sent again when the postcopy resumes.
+         */
+        if (postcopy_request_page(mis, rb, rb_offset,
+                                  msg.arg.pagefault.address)) {
+            continue;
+        }
+        postcopy_prefetch_pages(mis, pf, rb, rb_offset,
+                                msg.arg.pagefault.feat.ptid);
+    }
+    rcu_unregister_thread();
+    trace_postcopy_ram_fault_worker_exit();
+    return NULL;
+}
+
+static int postcopy_fault_workers_setup(MigrationIncomingState *mis)
+{
+    unsigned int nr = migrate_postcopy_fault_threads() - 1;
+    unsigned int i;
+
+    if (!nr) {
+        return 0;
+    }
+
+    mis->fault_workers_quit_fd = eventfd(0, EFD_CLOEXEC);
+    if (mis->fault_workers_quit_fd == -1) {
+        error_report("%s: Opening fault_workers_quit_fd: %s", __func__,
+                     strerror(errno));
+        return -1;
+    }
+
+    mis->fault_workers = g_new0(QemuThread, nr);
+    for (i = 0; i < nr; i++) {
+        g_autofree char *name =
+            g_strdup_printf(MIGRATION_THREAD_DST_FAULT_WORKER, i + 1);
+
+        postcopy_thread_create(mis, &mis->fault_workers[i], name,
+                               postcopy_ram_fault_worker,
+                               QEMU_THREAD_JOINABLE);
+        mis->nr_fault_workers++;
+    }
+    return 0;
+}
+
 static int postcopy_temp_pages_setup(MigrationIncomingState *mis)
 {
     PostcopyTmpPage *tmp_page;
@@ -1235,6 +1469,11 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
                            postcopy_ram_fault_thread, QEMU_THREAD_JOINABLE);
     mis->have_fault_thread = true;
 
+    if (postcopy_fault_workers_setup(mis)) {
+        /* Error dumped in the sub-function */
+        return -1;
+    }
+
     /* Mark so that we get notified of accesses to unwritten areas */
     if (foreach_not_ignored_block(ram_block_enable_notify, mis)) {
         error_report("ram_block_enable_notify failed");
@@ -32,6 +32,7 @@
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
 #include "qemu/main-loop.h"
+#include "block/thread-pool.h"
 #include "xbzrle.h"
 #include "ram.h"
 #include "migration.h"
@@ -118,7 +119,10 @@ static struct {
     uint8_t *encoded_buf;
     /* buffer for storing page content */
     uint8_t *current_buf;
-    /* Cache for XBZRLE, Protected by lock. */
+    /*
+     * Cache for XBZRLE, Protected by lock. The multifd send threads access
+     * it without the lock, under RCU and the per-entry cache locks.
+     */
     PageCache *cache;
     QemuMutex lock;
     /* it will store a page full of zeros */
@@ -156,7 +160,7 @@ static void XBZRLE_cache_unlock(void)
  */
 int xbzrle_cache_resize(uint64_t new_size, Error **errp)
 {
-    PageCache *new_cache;
+    PageCache *new_cache, *old_cache;
     int64_t ret = 0;
 
     /* Check for truncation */
@@ -180,14 +184,47 @@ int xbzrle_cache_resize(uint64_t new_size, Error **errp)
             goto out;
         }
 
-        cache_fini(XBZRLE.cache);
-        XBZRLE.cache = new_cache;
+        /* Unpublish the old cache before queuing its release */
+        old_cache = XBZRLE.cache;
+        qatomic_rcu_set(&XBZRLE.cache, new_cache);
+        cache_fini_rcu(old_cache);
     }
 out:
     XBZRLE_cache_unlock();
     return ret;
 }
 
+/**
+ * xbzrle_cache_rcu: get the xbzrle cache from a multifd send thread
+ *
+ * Returns the cache, or NULL if it has already been freed. The caller
+ * must be within an RCU read-side critical section and must lock the
+ * entries it accesses with cache_lock().
+ */
+PageCache *xbzrle_cache_rcu(void)
+{
+    return qatomic_rcu_read(&XBZRLE.cache);
+}
+
+/**
+ * xbzrle_counters_add: account the pages encoded by a multifd send thread
+ *
+ * @pages: number of pages found in the cache
+ * @bytes: number of bytes sent for these pages
+ * @cache_miss: number of pages not found in the cache
+ * @overflow: number of pages for which encoding was larger than the page
+ */
+void xbzrle_counters_add(uint64_t pages, uint64_t bytes, uint64_t cache_miss,
+                         uint64_t overflow)
+{
+    XBZRLE_cache_lock();
+    xbzrle_counters.pages += pages;
+    xbzrle_counters.bytes += bytes;
+    xbzrle_counters.cache_miss += cache_miss;
+    xbzrle_counters.overflow += overflow;
+    XBZRLE_cache_unlock();
+}
+
 static bool postcopy_preempt_active(void)
 {
     return migrate_postcopy_preempt() && migration_in_postcopy();
@@ -368,6 +405,10 @@ struct RAMState {
     bool xbzrle_started;
     /* Are we on the last stage of migration */
     bool last_stage;
+    /* Does the dirty bitmap track guest writes, for defer-hot-pages */
+    bool hot_pages_tracking;
+    /* Is the page search sending the hot pages, at the end of a pass */
+    bool hot_pages_round;
 
     /* total handled target pages at the beginning of period */
     uint64_t target_page_count_prev;
@@ -382,6 +423,8 @@ struct RAMState {
      * - pss structures
      */
     QemuMutex bitmap_mutex;
+    /* Threads merging the dirty bitmaps of large RAMBlocks, if any */
+    ThreadPool *bitmap_sync_threads;
     /* The RAMBlock used in the last src_page_requests */
     RAMBlock *last_req_rb;
     /* Queue of outstanding page requests from the destination */
@@ -563,10 +606,13 @@ void mig_throttle_counter_reset(void)
  */
 static void xbzrle_cache_zero_page(ram_addr_t current_addr)
 {
+    /* The multifd send threads may be using the entry */
+    cache_lock(XBZRLE.cache, current_addr);
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
     cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
                  stat64_get(&mig_stats.dirty_sync_count));
+    cache_unlock(XBZRLE.cache, current_addr);
 }
 
 #define ENCODING_FLAG_XBZRLE 0x1
@@ -705,6 +751,14 @@ static void pss_find_next_dirty(PageSearchStatus *pss)
     }
 
     pss->page = find_next_bit(bitmap, size, pss->page);
+
+    /* Hot pages are left for the end of the pass, see find_dirty_block() */
+    if (rb->hot_bmap && !pss->host_page_sending &&
+        !ram_state->hot_pages_round) {
+        while (pss->page < size && test_bit(pss->page, rb->hot_bmap)) {
+            pss->page = find_next_bit(bitmap, size, pss->page + 1);
+        }
+    }
 }
 
 static void migration_clear_memory_region_dirty_bitmap(RAMBlock *rb,
@@ -896,6 +950,142 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * Save the dirty bitmaps before a sync in hot_bmap, so that
+ * ram_update_hot_pages() can tell which bits the sync set.
+ *
+ * Called with RCU critical section and bitmap_mutex held
+ */
+static void ram_hot_pages_sync_begin(RAMState *rs)
+{
+    RAMBlock *block;
+
+    if (!rs->hot_pages_tracking) {
+        return;
+    }
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        bitmap_copy(block->hot_bmap, block->bmap,
+                    block->used_length >> TARGET_PAGE_BITS);
+    }
+}
+
+/*
+ * Classify as hot the pages that were newly dirtied both by this sync and
+ * by the previous one, and start a new pass over RAM with the other pages.
+ * Pages that are still dirty because they were deferred don't count, or
+ * they would stay hot forever.
+ *
+ * Called with RCU critical section and bitmap_mutex held, after
+ * ram_hot_pages_sync_begin() and the sync
+ */
+static void ram_update_hot_pages(RAMState *rs)
+{
+    uint64_t hot_pages = 0;
+    RAMBlock *block;
+
+    if (!rs->hot_pages_tracking) {
+        return;
+    }
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+        unsigned long k;
+
+        for (k = 0; k < BITS_TO_LONGS(pages); k++) {
+            unsigned long new_dirty = block->bmap[k] & ~block->hot_bmap[k];
+
+            block->hot_bmap[k] = new_dirty & block->last_dirty_bmap[k];
+            block->last_dirty_bmap[k] = new_dirty;
+            hot_pages += ctpopl(block->hot_bmap[k]);
+        }
+    }
+    rs->hot_pages_round = false;
+    trace_ram_update_hot_pages(hot_pages);
+}
+
+/* Amount of guest memory whose dirty bitmap is merged by a single task */
+#define BITMAP_SYNC_CHUNK_SIZE (1ULL << 30)
+
+typedef struct {
+    RAMBlock *rb;
+    ram_addr_t start;
+    ram_addr_t length;
+    uint64_t num_dirty;
+} BitmapSyncTask;
+
+static int bitmap_sync_task_run(void *opaque)
+{
+    BitmapSyncTask *task = opaque;
+
+    task->num_dirty = cpu_physical_memory_merge_dirty_bitmap(task->rb,
+                                                             task->start,
+                                                             task->length);
+    return 0;
+}
+
+/*
+ * Sync the dirty bitmaps of all RAMBlocks. The bitmaps of large blocks are
+ * split in chunks that the bitmap sync threads merge in parallel. The
+ * threads don't take the RCU read lock: the caller holds it until they are
+ * done, which keeps the blocks and the dirty memory bitmaps alive.
+ *
+ * Called with RCU critical section and bitmap_mutex held
+ */
+static void ram_sync_dirty_bitmaps(RAMState *rs)
+{
+    g_autoptr(GArray) tasks = g_array_new(false, false,
+                                          sizeof(BitmapSyncTask));
+    RAMBlock *block;
+    guint i;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t start;
+
+        if (!rs->bitmap_sync_threads ||
+            block->used_length <= BITMAP_SYNC_CHUNK_SIZE ||
+            !cpu_physical_memory_dirty_bitmap_aligned(block, 0,
+                                                      block->used_length)) {
+            ramblock_sync_dirty_bitmap(rs, block);
+            continue;
+        }
+
+        for (start = 0; start < block->used_length;
+             start += BITMAP_SYNC_CHUNK_SIZE) {
+            BitmapSyncTask task = {
+                .rb = block,
+                .start = start,
+                .length = MIN(BITMAP_SYNC_CHUNK_SIZE,
+                              block->used_length - start),
+            };
+
+            g_array_append_val(tasks, task);
+        }
+    }
+
+    if (!tasks->len) {
+        return;
+    }
+
+    trace_ram_sync_dirty_bitmaps(tasks->len);
+
+    for (i = 0; i < tasks->len; i++) {
+        thread_pool_submit(rs->bitmap_sync_threads, bitmap_sync_task_run,
+                           &g_array_index(tasks, BitmapSyncTask, i), NULL);
+    }
+    thread_pool_wait(rs->bitmap_sync_threads);
+
+    for (i = 0; i < tasks->len; i++) {
+        BitmapSyncTask *task = &g_array_index(tasks, BitmapSyncTask, i);
+
+        cpu_physical_memory_sync_dirty_bitmap_finish(task->rb, task->start,
+                                                     task->length,
+                                                     task->num_dirty);
+        rs->migration_dirty_pages += task->num_dirty;
+        rs->num_dirty_pages_period += task->num_dirty;
+    }
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -940,6 +1130,8 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
     if (migrate_xbzrle()) {
         double encoded_size, unencoded_size;
 
+        /* The multifd send threads update the counters concurrently */
+        XBZRLE_cache_lock();
         xbzrle_counters.cache_miss_rate = (double)(xbzrle_counters.cache_miss -
             rs->xbzrle_cache_miss_prev) / page_count;
         rs->xbzrle_cache_miss_prev = xbzrle_counters.cache_miss;
@@ -953,6 +1145,7 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
         }
         rs->xbzrle_pages_prev = xbzrle_counters.pages;
         rs->xbzrle_bytes_prev = xbzrle_counters.bytes;
+        XBZRLE_cache_unlock();
     }
 }
 
@@ -1017,7 +1210,6 @@ static void migration_trigger_throttle(RAMState *rs)
 
 static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 {
-    RAMBlock *block;
     int64_t end_time;
 
     stat64_add(&mig_stats.dirty_sync_count, 1);
@@ -1031,9 +1223,9 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 
     WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
         WITH_RCU_READ_LOCK_GUARD() {
-            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-                ramblock_sync_dirty_bitmap(rs, block);
-            }
+            ram_hot_pages_sync_begin(rs);
+            ram_sync_dirty_bitmaps(rs);
+            ram_update_hot_pages(rs);
             stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
         }
     }
@@ -1285,6 +1477,18 @@ static int find_dirty_block(RAMState *rs, PageSearchStatus *pss)
 
     if (pss->complete_round && pss->block == rs->last_seen_block &&
         pss->page >= rs->last_page) {
+        if (rs->hot_pages_tracking && !rs->hot_pages_round) {
+            /*
+             * All the cold pages are sent.  Go around the RAM once more,
+             * from where this search started, for the hot pages: the later
+             * they are sent, the less likely they are dirty again at the
+             * next sync.
+             */
+            rs->hot_pages_round = true;
+            pss->complete_round = false;
+            pss->page = rs->last_page;
+            return PAGE_TRY_AGAIN;
+        }
         /*
          * We've been once around the RAM and haven't found anything.
          * Give up.
@@ -1312,6 +1516,7 @@ static int find_dirty_block(RAMState *rs, PageSearchStatus *pss)
             /* After the first round, enable XBZRLE. */
             if (migrate_xbzrle()) {
                 rs->xbzrle_started = true;
+                multifd_xbzrle_set_started(true);
             }
         }
         /* Didn't find anything this time, but try again on the new block */
@@ -2275,6 +2480,9 @@ static void xbzrle_load_cleanup(void)
 static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
+        if ((*rsp)->bitmap_sync_threads) {
+            thread_pool_free((*rsp)->bitmap_sync_threads);
+        }
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
@@ -2285,13 +2493,16 @@ static void ram_state_cleanup(RAMState **rsp)
 
 static void xbzrle_cleanup(void)
 {
+    PageCache *old_cache;
+
     XBZRLE_cache_lock();
     if (XBZRLE.cache) {
-        cache_fini(XBZRLE.cache);
+        old_cache = XBZRLE.cache;
+        qatomic_rcu_set(&XBZRLE.cache, NULL);
+        cache_fini_rcu(old_cache);
         g_free(XBZRLE.encoded_buf);
         g_free(XBZRLE.current_buf);
         g_free(XBZRLE.zero_target_page);
-        XBZRLE.cache = NULL;
         XBZRLE.encoded_buf = NULL;
         XBZRLE.current_buf = NULL;
         XBZRLE.zero_target_page = NULL;
@@ -2310,6 +2521,10 @@ static void ram_bitmaps_destroy(void)
         block->bmap = NULL;
         g_free(block->file_bmap);
         block->file_bmap = NULL;
+        g_free(block->hot_bmap);
+        block->hot_bmap = NULL;
+        g_free(block->last_dirty_bmap);
+        block->last_dirty_bmap = NULL;
     }
 }
 
@@ -2351,6 +2566,8 @@ static void ram_state_reset(RAMState *rs)
     rs->last_page = 0;
     rs->last_version = ram_list.version;
     rs->xbzrle_started = false;
+    multifd_xbzrle_set_started(false);
+    rs->hot_pages_round = false;
 }
 
 #define MAX_WAIT 50 /* ms, half buffered_file limit */
@@ -2658,6 +2875,16 @@ static bool ram_state_init(RAMState **rsp, Error **errp)
     (*rsp)->migration_dirty_pages = (*rsp)->ram_bytes_total >> TARGET_PAGE_BITS;
     ram_state_reset(*rsp);
 
+    /*
+     * Multifd channels already tell how many threads the migration may
+     * use. Use as many to sync the dirty bitmaps of large guests.
+     */
+    if (migrate_multifd() && migrate_multifd_channels() > 1) {
+        (*rsp)->bitmap_sync_threads = thread_pool_new();
+        thread_pool_set_max_threads((*rsp)->bitmap_sync_threads,
+                                    migrate_multifd_channels());
+    }
+
     return true;
 }
 
@@ -2697,6 +2924,10 @@ static void ram_list_init_bitmaps(void)
             if (migrate_mapped_ram()) {
                 block->file_bmap = bitmap_new(pages);
             }
+            if (migrate_defer_hot_pages()) {
+                block->hot_bmap = bitmap_new(pages);
+                block->last_dirty_bmap = bitmap_new(pages);
+            }
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
         }
@@ -2731,6 +2962,12 @@ static bool ram_init_bitmaps(RAMState *rs, Error **errp)
                 goto out_unlock;
             }
             migration_bitmap_sync_precopy(false);
+            /*
+             * Hot pages are found from the bits that each sync newly sets.
+             * The bitmap was all ones up to now, so start with the next
+             * sync.
+             */
+            rs->hot_pages_tracking = migrate_defer_hot_pages();
         }
     }
 out_unlock:
@@ -32,6 +32,7 @@
 #include "qapi/qapi-types-migration.h"
 #include "exec/cpu-common.h"
 #include "io/channel.h"
+#include "page_cache.h"
 
 /*
  * RAM_SAVE_FLAG_ZERO used to be named RAM_SAVE_FLAG_COMPRESS, it
@@ -74,6 +75,9 @@ extern XBZRLECacheStats xbzrle_counters;
 
 void ram_mig_init(void);
 int xbzrle_cache_resize(uint64_t new_size, Error **errp);
+PageCache *xbzrle_cache_rcu(void);
+void xbzrle_counters_add(uint64_t pages, uint64_t bytes, uint64_t cache_miss,
+                         uint64_t overflow);
 uint64_t ram_bytes_remaining(void);
 uint64_t ram_bytes_total(void);
 void mig_throttle_counter_reset(void);
@@ -2265,7 +2265,8 @@ static gboolean postcopy_sync_page_req(gpointer key, gpointer value,
         return FALSE;
     }
 
-    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset);
+    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset,
+                                            qemu_ram_pagesize(rb));
     if (ret) {
         /* Please refer to above comment. */
         error_report("%s: send rp message failed for addr %p",
@@ -2297,7 +2298,9 @@ static int loadvm_postcopy_handle_resume(MigrationIncomingState *mis)
      * Reset the last_rb before we resend any page req to source again, since
      * the source should have it reset already.
      */
-    mis->last_rb = NULL;
+    WITH_QEMU_LOCK_GUARD(&mis->rp_mutex) {
+        mis->last_rb = NULL;
+    }
 
     /*
      * This means source VM is ready to resume the postcopy migration.
@@ -2326,9 +2329,9 @@ static int loadvm_postcopy_handle_resume(MigrationIncomingState *mis)
 
     /*
      * It's time to switch state and release the fault thread to continue
-     * service page faults.  Note that this should be explicitly after the
-     * above call to migrate_send_rp_req_pages_pending().  In short:
-     * migrate_send_rp_message_req_pages() is not thread safe, yet.
+     * service page faults.  The additional fault threads don't pause: the
+     * requests they failed to send are in the page request tree, and were
+     * sent again by migrate_send_rp_req_pages_pending() above.
      */
     qemu_sem_post(&mis->postcopy_pause_sem_fault);
 
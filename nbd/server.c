@@ -42,6 +42,20 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * Read payloads smaller than this are always copied into the socket; the
+ * page pinning and completion handling of MSG_ZEROCOPY only pay off for
+ * larger buffers.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE (64 * KiB)
+
+/*
+ * Read buffers sent with zero copy are kept until the kernel reports
+ * completion.  Completions are reaped once this many bytes, or
+ * MAX_NBD_REQUESTS buffers, are outstanding.
+ */
+#define NBD_ZERO_COPY_FLUSH_SIZE (16 * MiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -101,6 +115,8 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    bool zero_copy;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -140,6 +156,16 @@ struct NBDClient {
     CoMutex send_lock;
     Coroutine *send_coroutine;
 
+    /*
+     * Read buffers that may still be referenced by zero copy sends, and
+     * whether zero copy was given up for this client.  Protected by
+     * send_lock.
+     */
+    GPtrArray *zero_copy_bufs;
+    uint64_t zero_copy_bytes;
+    bool zero_copy_disabled;
+    bool zero_copy_failed;
+
     bool read_yielding; /* protected by lock */
     bool quiescing; /* protected by lock */
 
@@ -1581,6 +1607,11 @@ void nbd_client_put(NBDClient *client)
             blk_exp_unref(&client->exp->common);
         }
         g_free(client->contexts.bitmaps);
+        /*
+         * The channel has been shut down and closed, no reply that may
+         * still refer to these buffers is waited for anymore.
+         */
+        g_ptr_array_free(client->zero_copy_bufs, TRUE);
         qemu_mutex_destroy(&client->lock);
         g_free(client);
     }
@@ -1829,6 +1860,13 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
         return -EEXIST;
     }
 
+#ifndef CONFIG_LINUX
+    if (arg->zero_copy) {
+        error_setg(errp, "Zero copy currently only available on Linux");
+        return -ENOTSUP;
+    }
+#endif
+
     size = blk_getlength(blk);
     if (size < 0) {
         error_setg_errno(errp, -size,
@@ -1931,6 +1969,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -2032,8 +2071,24 @@ const BlockExportDriver blk_exp_nbd = {
     .request_shutdown   = nbd_export_request_shutdown,
 };
 
-static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
-                                        unsigned niov, Error **errp)
+/* Caller must hold client->send_lock */
+static bool nbd_client_use_zero_copy(NBDClient *client, size_t size)
+{
+    return client->exp->zero_copy && !client->zero_copy_disabled &&
+           size >= NBD_ZERO_COPY_MIN_SIZE &&
+           qio_channel_has_feature(client->ioc,
+                                   QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+}
+
+/*
+ * Send @niov buffers to the client.  If @payload is true, the last buffer
+ * is read data that may be sent with zero copy; in that case, it must not
+ * be freed or modified before it has been passed to
+ * nbd_co_zero_copy_release().
+ */
+static int coroutine_fn nbd_co_send_iov_full(NBDClient *client,
+                                             struct iovec *iov, unsigned niov,
+                                             bool payload, Error **errp)
 {
     int ret;
 
@@ -2041,7 +2096,20 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     qemu_co_mutex_lock(&client->send_lock);
     client->send_coroutine = qemu_coroutine_self();
 
-    ret = qio_channel_writev_all(client->ioc, iov, niov, errp) < 0 ? -EIO : 0;
+    if (payload && nbd_client_use_zero_copy(client, iov[niov - 1].iov_len)) {
+        trace_nbd_co_send_zero_copy(iov[niov - 1].iov_base,
+                                    iov[niov - 1].iov_len);
+        ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+        if (ret == 0) {
+            ret = qio_channel_writev_full_all(client->ioc, &iov[niov - 1], 1,
+                                              NULL, 0,
+                                              QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                              errp);
+        }
+    } else {
+        ret = qio_channel_writev_all(client->ioc, iov, niov, errp);
+    }
+    ret = ret < 0 ? -EIO : 0;
 
     client->send_coroutine = NULL;
     qemu_co_mutex_unlock(&client->send_lock);
@@ -2049,6 +2117,68 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
+                                        unsigned niov, Error **errp)
+{
+    return nbd_co_send_iov_full(client, iov, niov, false, errp);
+}
+
+/*
+ * Take ownership of the read buffer @data of size @size once its reply has
+ * been sent.  If zero copy is in use for @client, the buffer is only freed
+ * after the kernel has reported that it is done with it.
+ *
+ * Returns -EIO if the completions could not be reaped.  The buffers the
+ * kernel may still be sending from are then kept until the client goes
+ * away, and the caller should drop the connection.
+ */
+static int coroutine_fn nbd_co_zero_copy_release(NBDClient *client,
+                                                 void *data, uint64_t size,
+                                                 Error **errp)
+{
+    int ret;
+
+    qemu_co_mutex_lock(&client->send_lock);
+
+    if (!nbd_client_use_zero_copy(client, size)) {
+        qemu_co_mutex_unlock(&client->send_lock);
+        qemu_vfree(data);
+        return 0;
+    }
+
+    g_ptr_array_add(client->zero_copy_bufs, data);
+    client->zero_copy_bytes += size;
+    if (client->zero_copy_failed ||
+        (client->zero_copy_bufs->len < MAX_NBD_REQUESTS &&
+         client->zero_copy_bytes < NBD_ZERO_COPY_FLUSH_SIZE)) {
+        qemu_co_mutex_unlock(&client->send_lock);
+        return client->zero_copy_failed ? -EIO : 0;
+    }
+
+    /*
+     * In coroutine context, this yields until the outstanding completions
+     * have arrived.  By the time enough buffers have accumulated, most of
+     * them have usually arrived already.
+     */
+    ret = qio_channel_flush(client->ioc, errp);
+    trace_nbd_co_zero_copy_flush(client->zero_copy_bufs->len,
+                                 client->zero_copy_bytes, ret);
+    if (ret < 0) {
+        client->zero_copy_failed = true;
+        qemu_co_mutex_unlock(&client->send_lock);
+        return -EIO;
+    } else if (ret == 1) {
+        /* The kernel had to copy everything (e.g. loopback), stop trying */
+        client->zero_copy_disabled = true;
+    }
+
+    g_ptr_array_set_size(client->zero_copy_bufs, 0);
+    client->zero_copy_bytes = 0;
+
+    qemu_co_mutex_unlock(&client->send_lock);
+    return 0;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2080,7 +2210,8 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_iov_full(client, iov, 2,
+                                request->type == NBD_CMD_READ && len, errp);
 }
 
 /*
@@ -2161,7 +2292,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_iov_full(client, iov, 3, true, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -3146,6 +3277,15 @@ static coroutine_fn void nbd_trip(void *opaque)
         error_free(export_err);
     } else {
         ret = nbd_handle_request(client, &request, req->data, &local_err);
+        if (request.type == NBD_CMD_READ && req->data) {
+            int release_ret;
+
+            release_ret = nbd_co_zero_copy_release(client, req->data,
+                                                   request.len,
+                                                   ret < 0 ? NULL : &local_err);
+            ret = ret < 0 ? ret : release_ret;
+            req->data = NULL;
+        }
     }
     if (request.contexts && request.contexts != &client->contexts) {
         assert(request.type == NBD_CMD_BLOCK_STATUS);
@@ -3253,6 +3393,12 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
     }
 
     timer_free(handshake_timer);
+
+    /* Only pay for SO_ZEROCOPY on connections that will make use of it */
+    if (client->exp->zero_copy) {
+        qio_channel_socket_set_zero_copy(client->sioc);
+    }
+
     WITH_QEMU_LOCK_GUARD(&client->lock) {
         nbd_client_receive_next_request(client);
     }
@@ -3275,6 +3421,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
     Coroutine *co;
 
     client = g_new0(NBDClient, 1);
+    client->zero_copy_bufs = g_ptr_array_new_with_free_func(qemu_vfree);
     qemu_mutex_init(&client->lock);
     client->refcount = 1;
     client->tlscreds = tlscreds;
@@ -34,6 +34,7 @@
 #include "qapi/qobject-output-visitor.h"
 #include "qobject/qjson.h"
 #include "qobject/qdict.h"
+#include "qobject/qnum.h"
 #include "qemu/cutils.h"
 #include "qemu/config-file.h"
 #include "qemu/option.h"
@@ -86,6 +87,8 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_RW_MIX = 278,
+    OPTION_RANDOM = 279,
 };
 
 typedef enum OutputFormat {
@@ -1273,6 +1276,32 @@ static int is_allocated_sectors_min(const uint8_t *buf, int n, int *pnum,
     return 1;
 }
 
+/*
+ * Returns true if the first cluster of the buffer contains non-zero data,
+ * false if it is all zeroes. In both cases, 'pnum' is set to the number of
+ * sectors, starting at the beginning of the buffer, that are covered by
+ * consecutive clusters of the same kind. The buffer must start on a cluster
+ * boundary; only the last cluster may be shorter than 'cluster_sectors'.
+ */
+static bool is_allocated_clusters(const uint8_t *buf, int n, int *pnum,
+                                  int cluster_sectors)
+{
+    bool is_zero;
+    int i;
+
+    is_zero = buffer_is_zero(buf, MIN(n, cluster_sectors) * BDRV_SECTOR_SIZE);
+    for (i = cluster_sectors; i < n; i += cluster_sectors) {
+        if (buffer_is_zero(buf + i * BDRV_SECTOR_SIZE,
+                           MIN(n - i, cluster_sectors) * BDRV_SECTOR_SIZE)
+            != is_zero)
+        {
+            break;
+        }
+    }
+    *pnum = MIN(i, n);
+    return !is_zero;
+}
+
 /*
  * Compares two buffers chunk by chunk, where @chsize is the chunk size.
  * If @chsize is 0, default chunk size of BDRV_SECTOR_SIZE is used.
@@ -1667,6 +1696,13 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/* A chunk of the source as determined by the block status pass */
+typedef struct ImgConvertExtent {
+    int64_t sector_num;
+    int nb_sectors;
+    enum ImgConvertBlockStatus status;
+} ImgConvertExtent;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1675,10 +1711,11 @@ typedef struct ImgConvertState {
     int64_t total_sectors;
     int64_t allocated_sectors;
     int64_t allocated_done;
-    int64_t sector_num;
     int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
+    GArray *extents;
+    unsigned int next_extent;
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
@@ -1697,7 +1734,6 @@ typedef struct ImgConvertState {
     int running_coroutines;
     Coroutine *co[MAX_COROUTINES];
     int64_t wait_sector_num[MAX_COROUTINES];
-    CoMutex lock;
     int ret;
 } ImgConvertState;
 
@@ -1897,14 +1933,14 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
              * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
+             * case we can only save the write for completely zeroed
+             * clusters. */
             if (!s->min_sparse ||
                 (!s->compressed &&
                  is_allocated_sectors_min(buf, n, &n, s->min_sparse,
                                           sector_num, s->alignment)) ||
                 (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                 is_allocated_clusters(buf, n, &n, s->cluster_sectors)))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -1992,30 +2028,22 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         int64_t sector_num;
         enum ImgConvertBlockStatus status;
         bool copy_range;
+        ImgConvertExtent *extent;
 
-        qemu_co_mutex_lock(&s->lock);
-        if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
-            qemu_co_mutex_unlock(&s->lock);
-            break;
-        }
-        WITH_GRAPH_RDLOCK_GUARD() {
-            n = convert_iteration_sectors(s, s->sector_num);
-        }
-        if (n < 0) {
-            qemu_co_mutex_unlock(&s->lock);
-            s->ret = n;
+        if (s->ret != -EINPROGRESS || s->next_extent >= s->extents->len) {
             break;
         }
-        /* save current sector and allocation status to local variables */
-        sector_num = s->sector_num;
-        status = s->status;
-        if (!s->min_sparse && s->status == BLK_ZERO) {
-            n = MIN(n, s->buf_sectors);
-        }
-        /* increment global sector counter so that other coroutines can
-         * already continue reading beyond this request */
-        s->sector_num += n;
-        qemu_co_mutex_unlock(&s->lock);
+
+        /*
+         * The block status of the whole source was collected up front, so
+         * taking the next extent never yields and other coroutines can
+         * immediately continue reading beyond this request.
+         */
+        extent = &g_array_index(s->extents, ImgConvertExtent,
+                                s->next_extent++);
+        sector_num = extent->sector_num;
+        n = extent->nb_sectors;
+        status = extent->status;
 
         if (status == BLK_DATA || (!s->min_sparse && status == BLK_ZERO)) {
             s->allocated_done += n;
@@ -2024,7 +2052,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         }
 
 retry:
-        copy_range = s->copy_range && s->status == BLK_DATA;
+        copy_range = s->copy_range && status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
             ret = convert_co_read(s, sector_num, n, buf);
             if (ret < 0) {
@@ -2105,35 +2133,56 @@ static int convert_do_copy(ImgConvertState *s)
         bdrv_graph_rdunlock_main_loop();
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /* Allocate buffer for copied data. For compressed images, only whole
+     * clusters can be copied, so the buffer size must be a multiple of the
+     * cluster size. Copying several clusters at once lets the target driver
+     * compress them in parallel even when writes are kept in order. */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors, s->cluster_sectors);
     }
 
+    /*
+     * Query the block status of the whole source once and remember the
+     * resulting extents, so that the copy coroutines don't have to serialise
+     * on block status calls while they are reading and writing data.
+     */
+    s->extents = g_array_new(false, false, sizeof(ImgConvertExtent));
     while (sector_num < s->total_sectors) {
+        ImgConvertExtent extent;
+
         bdrv_graph_rdlock_main_loop();
         n = convert_iteration_sectors(s, sector_num);
         bdrv_graph_rdunlock_main_loop();
         if (n < 0) {
-            return n;
+            ret = n;
+            goto out;
+        }
+        if (!s->min_sparse && s->status == BLK_ZERO) {
+            /* These are written as data from the buffer */
+            n = MIN(n, s->buf_sectors);
         }
         if (s->status == BLK_DATA || (!s->min_sparse && s->status == BLK_ZERO))
         {
             s->allocated_sectors += n;
         }
+
+        extent = (ImgConvertExtent) {
+            .sector_num = sector_num,
+            .nb_sectors = n,
+            .status     = s->status,
+        };
+        g_array_append_val(s->extents, extent);
         sector_num += n;
     }
 
     /* Do the copy */
-    s->sector_next_status = 0;
+    s->next_extent = 0;
     s->ret = -EINPROGRESS;
 
-    qemu_co_mutex_init(&s->lock);
     for (i = 0; i < s->num_coroutines; i++) {
         s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
         s->wait_sector_num[i] = -1;
@@ -2144,15 +2193,16 @@ static int convert_do_copy(ImgConvertState *s)
         main_loop_wait(false);
     }
 
-    if (s->compressed && !s->ret) {
+    ret = s->ret;
+    if (s->compressed && !ret) {
         /* signal EOF to align */
         ret = blk_pwrite_compressed(s->target, 0, 0, NULL);
-        if (ret < 0) {
-            return ret;
-        }
     }
 
-    return s->ret;
+out:
+    g_array_free(s->extents, true);
+    s->extents = NULL;
+    return ret;
 }
 
 /* Check that bitmaps can be copied, or output an error */
@@ -2200,7 +2250,7 @@ static int convert_copy_bitmaps(BlockDriverState *src, BlockDriverState *dst,
                                    true, bdrv_dirty_bitmap_granularity(bm),
                                    true, true,
                                    true, !bdrv_dirty_bitmap_enabled(bm),
-                                   &err);
+                                   false, false, &err);
         if (err) {
             error_reportf_err(err, "Failed to create bitmap %s: ", name);
             return -1;
@@ -4410,10 +4460,41 @@ out_no_progress:
     return 0;
 }
 
-typedef struct BenchData {
+/*
+ * Request latencies are collected in a log-linear histogram: values below
+ * 2^BENCH_LAT_SUB_BITS nanoseconds get a bucket each, above that every
+ * power of two is split into 2^BENCH_LAT_SUB_BITS buckets.  This keeps the
+ * error of the reported percentiles below about 6%.
+ */
+#define BENCH_LAT_SUB_BITS 4
+#define BENCH_LAT_SUB_BUCKETS (1 << BENCH_LAT_SUB_BITS)
+#define BENCH_LAT_BUCKETS \
+    ((64 - BENCH_LAT_SUB_BITS + 1) * BENCH_LAT_SUB_BUCKETS)
+
+typedef struct BenchStats {
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t lat_min;
+    uint64_t lat_max;
+    uint64_t lat_total;
+    uint64_t lat_hist[BENCH_LAT_BUCKETS];
+} BenchStats;
+
+typedef struct BenchData BenchData;
+
+typedef struct BenchRequest {
+    BenchData *b;
+    bool write;
+    int64_t start_ns;
+} BenchRequest;
+
+struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
     bool write;
+    int read_percent;
+    bool random;
+    GRand *rand;
     int bufsize;
     int step;
     int nrreq;
@@ -4422,11 +4503,127 @@ typedef struct BenchData {
     bool drain_on_flush;
     uint8_t *buf;
     QEMUIOVector *qiov;
+    BenchRequest *reqs;
+    int *free_slots;
+    int nr_free_slots;
 
     int in_flight;
     bool in_flush;
     uint64_t offset;
-} BenchData;
+
+    BenchStats read_stats;
+    BenchStats write_stats;
+};
+
+static unsigned int bench_lat_bucket(uint64_t ns)
+{
+    int msb;
+
+    if (ns < BENCH_LAT_SUB_BUCKETS) {
+        return ns;
+    }
+
+    msb = 63 - clz64(ns);
+    return ((msb - BENCH_LAT_SUB_BITS + 1) << BENCH_LAT_SUB_BITS) |
+           ((ns >> (msb - BENCH_LAT_SUB_BITS)) & (BENCH_LAT_SUB_BUCKETS - 1));
+}
+
+/* Returns the lowest latency that falls into the given bucket */
+static uint64_t bench_lat_bucket_start(unsigned int bucket)
+{
+    unsigned int group = bucket >> BENCH_LAT_SUB_BITS;
+    uint64_t sub = bucket & (BENCH_LAT_SUB_BUCKETS - 1);
+
+    if (group == 0) {
+        return sub;
+    }
+    return (BENCH_LAT_SUB_BUCKETS | sub) << (group - 1);
+}
+
+static void bench_stats_add(BenchStats *stats, uint64_t bytes, uint64_t ns)
+{
+    if (!stats->requests || ns < stats->lat_min) {
+        stats->lat_min = ns;
+    }
+    stats->lat_max = MAX(stats->lat_max, ns);
+    stats->lat_total += ns;
+    stats->lat_hist[bench_lat_bucket(ns)]++;
+    stats->requests++;
+    stats->bytes += bytes;
+}
+
+/* Returns the latency in nanoseconds below which @permille of requests are */
+static uint64_t bench_stats_percentile(BenchStats *stats, unsigned permille)
+{
+    uint64_t threshold = DIV_ROUND_UP(stats->requests * permille, 1000);
+    uint64_t seen = 0;
+    unsigned int i;
+
+    for (i = 0; i < BENCH_LAT_BUCKETS; i++) {
+        seen += stats->lat_hist[i];
+        if (seen >= threshold && seen) {
+            return MIN(MAX(bench_lat_bucket_start(i), stats->lat_min),
+                       stats->lat_max);
+        }
+    }
+    return stats->lat_max;
+}
+
+static const struct {
+    const char *name;
+    unsigned permille;
+} bench_percentiles[] = {
+    { "p50",   500 },
+    { "p90",   900 },
+    { "p99",   990 },
+    { "p99.9", 999 },
+};
+
+static QDict *bench_stats_to_qdict(BenchStats *stats, double secs)
+{
+    QDict *dict = qdict_new();
+    QDict *lat = qdict_new();
+    int i;
+
+    qdict_put_int(dict, "requests", stats->requests);
+    qdict_put_int(dict, "bytes", stats->bytes);
+    qdict_put(dict, "iops", qnum_from_double(stats->requests / secs));
+    qdict_put(dict, "bytes-per-second",
+              qnum_from_double(stats->bytes / secs));
+
+    qdict_put_int(lat, "min", stats->lat_min);
+    qdict_put_int(lat, "mean", stats->lat_total / stats->requests);
+    qdict_put_int(lat, "max", stats->lat_max);
+    for (i = 0; i < ARRAY_SIZE(bench_percentiles); i++) {
+        qdict_put_int(lat, bench_percentiles[i].name,
+                      bench_stats_percentile(stats,
+                                             bench_percentiles[i].permille));
+    }
+    qdict_put(dict, "latency-ns", lat);
+
+    return dict;
+}
+
+static void bench_stats_print(const char *name, BenchStats *stats,
+                              double secs)
+{
+    int i;
+
+    printf("%s: %" PRIu64 " requests, %.0f IOPS, %.1f MiB/s\n",
+           name, stats->requests, stats->requests / secs,
+           stats->bytes / secs / MiB);
+    printf("  latency (us): min %.1f, mean %.1f, max %.1f\n",
+           stats->lat_min / 1000.0,
+           (double)stats->lat_total / stats->requests / 1000.0,
+           stats->lat_max / 1000.0);
+    printf("  percentiles (us):");
+    for (i = 0; i < ARRAY_SIZE(bench_percentiles); i++) {
+        printf("%s %s %.1f", i ? "," : "", bench_percentiles[i].name,
+               bench_stats_percentile(stats, bench_percentiles[i].permille)
+               / 1000.0);
+    }
+    printf("\n");
+}
 
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
@@ -4436,6 +4633,40 @@ static void bench_undrained_flush_cb(void *opaque, int ret)
     }
 }
 
+static void bench_cb(void *opaque, int ret);
+
+static void bench_request_cb(void *opaque, int ret)
+{
+    BenchRequest *req = opaque;
+    BenchData *b = req->b;
+
+    if (ret >= 0) {
+        bench_stats_add(req->write ? &b->write_stats : &b->read_stats,
+                        b->bufsize,
+                        qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - req->start_ns);
+    }
+    b->free_slots[b->nr_free_slots++] = req - b->reqs;
+
+    bench_cb(b, ret);
+}
+
+static uint64_t bench_next_offset(BenchData *b)
+{
+    uint64_t offset = b->offset;
+
+    if (b->random) {
+        uint64_t nr_blocks = b->image_size / b->bufsize;
+        uint64_t r = ((uint64_t)g_rand_int(b->rand) << 32) |
+                     g_rand_int(b->rand);
+
+        return (r % nr_blocks) * b->bufsize;
+    }
+
+    b->offset += b->step;
+    b->offset %= b->image_size;
+    return offset;
+}
+
 static void bench_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
@@ -4481,18 +4712,25 @@ static void bench_cb(void *opaque, int ret)
     }
 
     while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
+        int slot = b->free_slots[--b->nr_free_slots];
+        BenchRequest *req = &b->reqs[slot];
+        int64_t offset = bench_next_offset(b);
+
         /* blk_aio_* might look for completed I/Os and kick bench_cb
          * again, so make sure this operation is counted by in_flight
          * and b->offset is ready for the next submission.
          */
         b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        req->write = b->read_percent == 0 ||
+                     (b->read_percent < 100 &&
+                      g_rand_int_range(b->rand, 0, 100) >= b->read_percent);
+        req->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        if (req->write) {
+            acb = blk_aio_pwritev(b->blk, offset, &b->qiov[slot], 0,
+                                  bench_request_cb, req);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_preadv(b->blk, offset, &b->qiov[slot], 0,
+                                 bench_request_cb, req);
         }
         if (!acb) {
             error_report("Failed to issue request");
@@ -4516,12 +4754,16 @@ static int img_bench(int argc, char **argv)
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    int read_percent = -1;
+    bool random = false;
+    OutputFormat output_format = OFORMAT_HUMAN;
     int64_t image_size;
     BlockBackend *blk = NULL;
     BenchData data = {};
     int flags = 0;
     bool writethrough = false;
     struct timeval t1, t2;
+    double secs;
     int i;
     bool force_share = false;
     size_t buf_size = 0;
@@ -4530,10 +4772,14 @@ static int img_bench(int argc, char **argv)
         static const struct option long_options[] = {
             {"help", no_argument, 0, 'h'},
             {"flush-interval", required_argument, 0, OPTION_FLUSH_INTERVAL},
+            {"object", required_argument, 0, OPTION_OBJECT},
             {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"rw-mix", required_argument, 0, OPTION_RW_MIX},
+            {"random", no_argument, 0, OPTION_RANDOM},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options,
@@ -4664,9 +4910,37 @@ static int img_bench(int argc, char **argv)
         case OPTION_NO_DRAIN:
             drain_on_flush = false;
             break;
+        case OPTION_OBJECT:
+            user_creatable_process_cmdline(optarg);
+            break;
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
+        case OPTION_RW_MIX:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid read percentage specified");
+                return 1;
+            }
+            read_percent = res;
+            break;
+        }
+        case OPTION_RANDOM:
+            random = true;
+            break;
+        case OPTION_OUTPUT:
+            if (!strcmp(optarg, "json")) {
+                output_format = OFORMAT_JSON;
+            } else if (!strcmp(optarg, "human")) {
+                output_format = OFORMAT_HUMAN;
+            } else {
+                error_report("--output must be used with human or json "
+                             "as argument.");
+                return 1;
+            }
+            break;
         }
     }
 
@@ -4675,6 +4949,20 @@ static int img_bench(int argc, char **argv)
     }
     filename = argv[argc - 1];
 
+    if (read_percent >= 0 && !is_write) {
+        error_report("--rw-mix requires -w");
+        ret = -1;
+        goto out;
+    }
+    if (read_percent < 0) {
+        read_percent = is_write ? 0 : 100;
+    }
+    if (random && step) {
+        error_report("--random and -S can't be used together");
+        ret = -1;
+        goto out;
+    }
+
     if (!is_write && flush_interval) {
         error_report("--flush-interval is only available in write tests");
         ret = -1;
@@ -4698,6 +4986,11 @@ static int img_bench(int argc, char **argv)
         ret = image_size;
         goto out;
     }
+    if (random && image_size < bufsize) {
+        error_report("Image is smaller than the buffer size");
+        ret = -1;
+        goto out;
+    }
 
     data = (BenchData) {
         .blk            = blk,
@@ -4708,15 +5001,31 @@ static int img_bench(int argc, char **argv)
         .n              = count,
         .offset         = offset,
         .write          = is_write,
+        .read_percent   = read_percent,
+        .random         = random,
+        /* Use a fixed seed so that runs can be compared with each other */
+        .rand           = g_rand_new_with_seed(0),
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
     };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
+    if (output_format == OFORMAT_HUMAN) {
+        if (read_percent > 0 && read_percent < 100) {
+            printf("Sending %d requests (%d%% reads), ", data.n, read_percent);
+        } else {
+            printf("Sending %d %s requests, ",
+                   data.n, data.write ? "write" : "read");
+        }
+        if (random) {
+            printf("%d bytes each, %d in parallel (random offsets)\n",
+                   data.bufsize, data.nrreq);
+        } else {
+            printf("%d bytes each, %d in parallel "
+                   "(starting at offset %" PRId64 ", step size %d)\n",
+                   data.bufsize, data.nrreq, data.offset, data.step);
+        }
+        if (flush_interval) {
+            printf("Sending flush every %d requests\n", flush_interval);
+        }
     }
 
     buf_size = data.nrreq * data.bufsize;
@@ -4726,11 +5035,16 @@ static int img_bench(int argc, char **argv)
     blk_register_buf(blk, data.buf, buf_size, &error_fatal);
 
     data.qiov = g_new(QEMUIOVector, data.nrreq);
+    data.reqs = g_new(BenchRequest, data.nrreq);
+    data.free_slots = g_new(int, data.nrreq);
     for (i = 0; i < data.nrreq; i++) {
         qemu_iovec_init(&data.qiov[i], 1);
         qemu_iovec_add(&data.qiov[i],
                        data.buf + i * data.bufsize, data.bufsize);
+        data.reqs[i] = (BenchRequest) { .b = &data };
+        data.free_slots[i] = i;
     }
+    data.nr_free_slots = data.nrreq;
 
     gettimeofday(&t1, NULL);
     bench_cb(&data, 0);
@@ -4740,14 +5054,51 @@ static int img_bench(int argc, char **argv)
     }
     gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    secs = (t2.tv_sec - t1.tv_sec) +
+           ((double)(t2.tv_usec - t1.tv_usec) / 1000000);
+
+    if (output_format == OFORMAT_JSON) {
+        QDict *dict = qdict_new();
+        GString *str;
+
+        qdict_put(dict, "seconds", qnum_from_double(secs));
+        if (data.read_stats.requests) {
+            qdict_put(dict, "read",
+                      bench_stats_to_qdict(&data.read_stats, secs));
+        }
+        if (data.write_stats.requests) {
+            qdict_put(dict, "write",
+                      bench_stats_to_qdict(&data.write_stats, secs));
+        }
+        str = qobject_to_json_pretty(QOBJECT(dict), true);
+        printf("%s\n", str->str);
+        g_string_free(str, true);
+        qobject_unref(dict);
+    } else {
+        printf("Run completed in %3.3f seconds.\n", secs);
+        if (data.read_stats.requests) {
+            bench_stats_print("read", &data.read_stats, secs);
+        }
+        if (data.write_stats.requests) {
+            bench_stats_print("write", &data.write_stats, secs);
+        }
+    }
 
 out:
     if (data.buf) {
         blk_unregister_buf(blk, data.buf, buf_size);
     }
+    if (data.qiov) {
+        for (i = 0; i < data.nrreq; i++) {
+            qemu_iovec_destroy(&data.qiov[i]);
+        }
+    }
+    g_free(data.qiov);
+    g_free(data.reqs);
+    g_free(data.free_slots);
+    if (data.rand) {
+        g_rand_free(data.rand);
+    }
     qemu_vfree(data.buf);
     blk_unref(blk);
 
@@ -4932,7 +5283,7 @@ static int img_bitmap(int argc, char **argv)
         case BITMAP_ADD:
             qmp_block_dirty_bitmap_add(bs->node_name, bitmap,
                                        !!granularity, granularity, true, true,
-                                       false, false, &err);
+                                       false, false, false, false, &err);
             op = "add";
             break;
         case BITMAP_REMOVE:
@@ -41,6 +41,24 @@ static void test_multifd_tcp_zstd(void)
 }
 #endif /* CONFIG_ZSTD */
 
+#ifdef CONFIG_LZ4
+static void *
+migrate_hook_start_precopy_tcp_multifd_lz4(QTestState *from,
+                                           QTestState *to)
+{
+    return migrate_hook_start_precopy_tcp_multifd_common(from, to, "lz4");
+}
+
+static void test_multifd_tcp_lz4(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = migrate_hook_start_precopy_tcp_multifd_lz4,
+    };
+    test_precopy_common(&args);
+}
+#endif /* CONFIG_LZ4 */
+
 #ifdef CONFIG_QATZIP
 static void *
 migrate_hook_start_precopy_tcp_multifd_qatzip(QTestState *from,
@@ -128,6 +146,28 @@ static void test_precopy_unix_xbzrle(void)
     test_precopy_common(&args);
 }
 
+static void *
+migrate_hook_start_precopy_tcp_multifd_xbzrle(QTestState *from,
+                                              QTestState *to)
+{
+    migrate_hook_start_xbzrle(from, to);
+
+    return migrate_hook_start_precopy_tcp_multifd_common(from, to, "none");
+}
+
+static void test_multifd_tcp_xbzrle(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = migrate_hook_start_precopy_tcp_multifd_xbzrle,
+        .iterations = 2,
+        /* Pages need to be modified after the first pass, see above */
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
 static void *
 migrate_hook_start_precopy_tcp_multifd_zlib(QTestState *from,
                                             QTestState *to)
@@ -172,6 +212,11 @@ void migration_test_add_compression(MigrationTestEnv *env)
                        test_multifd_tcp_zstd);
 #endif
 
+#ifdef CONFIG_LZ4
+    migration_test_add("/migration/multifd/tcp/plain/lz4",
+                       test_multifd_tcp_lz4);
+#endif
+
 #ifdef CONFIG_QATZIP
     migration_test_add("/migration/multifd/tcp/plain/qatzip",
                        test_multifd_tcp_qatzip);
@@ -190,5 +235,7 @@ void migration_test_add_compression(MigrationTestEnv *env)
     if (g_test_slow()) {
         migration_test_add("/migration/precopy/unix/xbzrle",
                            test_precopy_unix_xbzrle);
+        migration_test_add("/migration/multifd/tcp/plain/xbzrle",
+                           test_multifd_tcp_xbzrle);
     }
 }
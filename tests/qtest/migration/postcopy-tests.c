@@ -45,6 +45,24 @@ static void test_postcopy_preempt(void)
     test_postcopy_common(&args);
 }
 
+static void *migrate_hook_start_postcopy_fault_threads(QTestState *from,
+                                                      QTestState *to)
+{
+    migrate_set_parameter_int(to, "postcopy-fault-threads", 4);
+    migrate_set_parameter_int(to, "postcopy-prefetch-size", 1 * 1024 * 1024);
+
+    return NULL;
+}
+
+static void test_postcopy_fault_threads(void)
+{
+    MigrateCommon args = {
+        .start_hook = migrate_hook_start_postcopy_fault_threads,
+    };
+
+    test_postcopy_common(&args);
+}
+
 static void test_postcopy_recovery(void)
 {
     MigrateCommon args = { };
@@ -102,6 +120,9 @@ void migration_test_add_postcopy(MigrationTestEnv *env)
         migration_test_add("/migration/postcopy/preempt/recovery/plain",
                            test_postcopy_preempt_recovery);
 
+        migration_test_add("/migration/postcopy/fault-threads",
+                           test_postcopy_fault_threads);
+
         migration_test_add(
             "/migration/postcopy/recovery/double-failures/handshake",
             test_postcopy_recovery_fail_handshake);
@@ -135,6 +135,26 @@ static void test_precopy_tcp_switchover_ack(void)
     test_precopy_common(&args);
 }
 
+static void *migrate_hook_start_defer_hot_pages(QTestState *from,
+                                                QTestState *to)
+{
+    migrate_set_capability(from, "defer-hot-pages", true);
+
+    return NULL;
+}
+
+static void test_precopy_tcp_defer_hot_pages(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "tcp:127.0.0.1:0",
+        .start_hook = migrate_hook_start_defer_hot_pages,
+        /* Go through several passes to classify the hot pages */
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
 #ifndef _WIN32
 static void *migrate_hook_start_fd(QTestState *from,
                                    QTestState *to)
@@ -1138,6 +1158,8 @@ void migration_test_add_precopy(MigrationTestEnv *env)
 
     migration_test_add("/migration/precopy/tcp/plain/switchover-ack",
                        test_precopy_tcp_switchover_ack);
+    migration_test_add("/migration/precopy/tcp/plain/defer-hot-pages",
+                       test_precopy_tcp_defer_hot_pages);
 
 #ifndef _WIN32
     migration_test_add("/migration/precopy/fd/tcp",
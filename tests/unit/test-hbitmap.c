@@ -13,6 +13,8 @@
 #include "qemu/hbitmap.h"
 #include "qemu/bitmap.h"
 #include "block/block.h"
+#include "qapi/error.h"
+#include "qemu/thread.h"
 
 #define LOG_BITS_PER_LONG          (BITS_PER_LONG == 32 ? 5 : 6)
 
@@ -26,6 +28,7 @@ typedef struct TestHBitmapData {
     size_t         size;
     size_t         old_size;
     int            granularity;
+    bool           sparse;
 } TestHBitmapData;
 
 
@@ -79,7 +82,11 @@ static void hbitmap_test_init(TestHBitmapData *data,
                               uint64_t size, int granularity)
 {
     size_t n;
-    data->hb = hbitmap_alloc(size, granularity);
+    if (data->sparse) {
+        data->hb = hbitmap_alloc_sparse(size, granularity);
+    } else {
+        data->hb = hbitmap_alloc(size, granularity);
+    }
 
     n = DIV_ROUND_UP(size, BITS_PER_LONG);
     if (n == 0) {
@@ -793,11 +800,23 @@ static void test_hbitmap_serialize_zeroes(TestHBitmapData *data,
     }
 }
 
+static void hbitmap_test_setup_sparse(TestHBitmapData *data,
+                                      const void *unused)
+{
+    data->sparse = true;
+}
+
+/* Every test is run both for normal and for sparse bitmaps */
 static void hbitmap_test_add(const char *testpath,
                                    void (*test_func)(TestHBitmapData *data, const void *user_data))
 {
+    g_autofree char *sparse_path =
+        g_strdup_printf("/hbitmap-sparse%s", testpath + strlen("/hbitmap"));
+
     g_test_add(testpath, TestHBitmapData, NULL, NULL, test_func,
                hbitmap_test_teardown);
+    g_test_add(sparse_path, TestHBitmapData, NULL, hbitmap_test_setup_sparse,
+               test_func, hbitmap_test_teardown);
 }
 
 static void test_hbitmap_iter_and_reset(TestHBitmapData *data,
@@ -1042,6 +1061,117 @@ static void test_hbitmap_next_dirty_area_after_truncate(TestHBitmapData *data,
     test_hbitmap_next_dirty_area_check(data, 0, INT64_MAX);
 }
 
+/* Sparse and normal bitmaps with the same contents must be interchangeable */
+static void test_hbitmap_sparse_compat(void)
+{
+    uint64_t size = 64 * L2;
+    HBitmap *dense = hbitmap_alloc(size, 0);
+    HBitmap *sparse = hbitmap_alloc_sparse(size, 0);
+    HBitmap *merged = hbitmap_alloc_sparse(size, 0);
+    g_autofree char *dense_hash = NULL;
+    g_autofree char *sparse_hash = NULL;
+
+    g_assert_false(hbitmap_is_sparse(dense));
+    g_assert_true(hbitmap_is_sparse(sparse));
+
+    hbitmap_set(dense, 3, 100);
+    hbitmap_set(dense, 40 * L2 - 5, 2 * L1);
+    hbitmap_set(sparse, 40 * L2 - 5, 2 * L1);
+    hbitmap_set(sparse, 3, 100);
+    hbitmap_set(sparse, 17 * L2, L2);
+    hbitmap_reset(sparse, 17 * L2, L2);
+
+    dense_hash = hbitmap_sha256(dense, &error_abort);
+    sparse_hash = hbitmap_sha256(sparse, &error_abort);
+    g_assert_cmpstr(dense_hash, ==, sparse_hash);
+
+    hbitmap_merge(dense, merged, merged);
+    g_assert_cmpint(hbitmap_count(merged), ==, hbitmap_count(dense));
+    g_assert_cmpint(hbitmap_next_dirty(merged, 0, size), ==, 3);
+    g_assert_cmpint(hbitmap_next_zero(merged, 3, size), ==, 103);
+    g_assert_cmpint(hbitmap_next_dirty(merged, 103, size), ==, 40 * L2 - 5);
+
+    hbitmap_free(dense);
+    hbitmap_free(sparse);
+    hbitmap_free(merged);
+}
+
+#if HOST_LONG_BITS == 64
+#define ATOMIC_THREADS 4
+
+typedef struct TestHBitmapAtomicData {
+    HBitmap *hb;
+    uint64_t size;
+    int index;
+} TestHBitmapAtomicData;
+
+/*
+ * Each thread sets overlapping runs of bits with a different stride, so
+ * that threads keep racing on the same words at every level.
+ */
+static void *test_hbitmap_atomic_thread(void *opaque)
+{
+    TestHBitmapAtomicData *d = opaque;
+    uint64_t stride = L1 + 7 * d->index + 1;
+    uint64_t pos;
+
+    for (pos = d->index; pos + 2 * BITS_PER_LONG <= d->size; pos += stride) {
+        hbitmap_set_atomic(d->hb, pos, 2 * BITS_PER_LONG);
+    }
+    return NULL;
+}
+
+static void test_hbitmap_atomic_one(bool sparse)
+{
+    uint64_t size = 16 * L2;
+    HBitmap *hb = sparse ? hbitmap_alloc_sparse(size, 0)
+                         : hbitmap_alloc(size, 0);
+    HBitmap *ref = hbitmap_alloc(size, 0);
+    TestHBitmapAtomicData data[ATOMIC_THREADS];
+    QemuThread threads[ATOMIC_THREADS];
+    g_autofree char *hash = NULL;
+    g_autofree char *ref_hash = NULL;
+    int i;
+
+    for (i = 0; i < ATOMIC_THREADS; i++) {
+        data[i] = (TestHBitmapAtomicData) {
+            .hb = hb,
+            .size = size,
+            .index = i,
+        };
+        qemu_thread_create(&threads[i], "hbitmap-set",
+                           test_hbitmap_atomic_thread, &data[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < ATOMIC_THREADS; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    /* Replay the same updates sequentially for comparison */
+    for (i = 0; i < ATOMIC_THREADS; i++) {
+        data[i].hb = ref;
+        test_hbitmap_atomic_thread(&data[i]);
+    }
+
+    g_assert_cmpint(hbitmap_count(hb), ==, hbitmap_count(ref));
+    hash = hbitmap_sha256(hb, &error_abort);
+    ref_hash = hbitmap_sha256(ref, &error_abort);
+    g_assert_cmpstr(hash, ==, ref_hash);
+    g_assert_cmpint(hbitmap_next_dirty(hb, 0, size), ==, 0);
+    g_assert_cmpint(hbitmap_next_zero(hb, 0, size), ==,
+                    hbitmap_next_zero(ref, 0, size));
+
+    hbitmap_free(hb);
+    hbitmap_free(ref);
+}
+
+static void test_hbitmap_atomic(void)
+{
+    test_hbitmap_atomic_one(false);
+    test_hbitmap_atomic_one(true);
+}
+#endif
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1113,6 +1243,11 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/next_dirty_area/next_dirty_area_after_truncate",
                      test_hbitmap_next_dirty_area_after_truncate);
 
+    g_test_add_func("/hbitmap-sparse/compat", test_hbitmap_sparse_compat);
+#if HOST_LONG_BITS == 64
+    g_test_add_func("/hbitmap/set_atomic", test_hbitmap_atomic);
+#endif
+
     g_test_run();
 
     return 0;
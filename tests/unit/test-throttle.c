@@ -22,6 +22,7 @@
 #include "qemu/module.h"
 #include "block/throttle-groups.h"
 #include "system/block-backend.h"
+#include "qom/object_interfaces.h"
 
 static AioContext     *ctx;
 static LeakyBucket    bkt;
@@ -801,6 +802,83 @@ static void test_groups(void)
     g_assert(tgm3->throttle_state == NULL);
 }
 
+typedef struct {
+    ThrottleGroupMember *tgm;
+    int64_t bytes;
+    int count;
+} CacheTestData;
+
+static void coroutine_fn cache_test_entry(void *opaque)
+{
+    CacheTestData *data = opaque;
+    int i;
+
+    for (i = 0; i < data->count; i++) {
+        throttle_group_co_io_limits_intercept(data->tgm, data->bytes,
+                                              THROTTLE_READ);
+    }
+}
+
+static void cache_test_run(ThrottleGroupMember *tgm, int64_t bytes, int count)
+{
+    CacheTestData data = { .tgm = tgm, .bytes = bytes, .count = count };
+    Coroutine *co = qemu_coroutine_create(cache_test_entry, &data);
+
+    /* None of the requests is throttled, so this completes immediately */
+    qemu_coroutine_enter(co);
+}
+
+static void test_group_cache(void)
+{
+    ThrottleConfig cfg1, cfg2;
+    BlockBackend *blk;
+    ThrottleGroupMember *tgm;
+    Object *group;
+    double level;
+
+    group = object_new_with_props(TYPE_THROTTLE_GROUP,
+                                  object_get_objects_root(), "cached",
+                                  &error_abort, "local-cache-ms", "100",
+                                  NULL);
+
+    blk = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    tgm = &blk_get_public(blk)->throttle_group_member;
+    throttle_group_register_tgm(tgm, "cached", blk_get_aio_context(blk));
+
+    throttle_config_init(&cfg1);
+    cfg1.buckets[THROTTLE_BPS_READ].avg = 1000 * 1000;
+    throttle_group_config(tgm, &cfg1);
+
+    /*
+     * The first request takes 100 ms worth of I/O from the group, the
+     * following 25 requests are served from the local cache.
+     */
+    cache_test_run(tgm, 4000, 26);
+    throttle_group_get_config(tgm, &cfg2);
+    level = cfg2.buckets[THROTTLE_BPS_READ].level;
+    g_assert_cmpfloat(level, >, 100000);
+    g_assert_cmpfloat(level, <=, 104000);
+
+    /* Changing the configuration drops the cache */
+    throttle_group_config(tgm, &cfg1);
+    cache_test_run(tgm, 4000, 1);
+    throttle_group_get_config(tgm, &cfg2);
+    level = cfg2.buckets[THROTTLE_BPS_READ].level;
+    g_assert_cmpfloat(level, >, 100000);
+    g_assert_cmpfloat(level, <=, 104000);
+
+    /* Without cache every request is accounted in the group right away */
+    object_property_set_uint(group, "local-cache-ms", 0, &error_abort);
+    throttle_group_config(tgm, &cfg1);
+    cache_test_run(tgm, 4000, 2);
+    throttle_group_get_config(tgm, &cfg2);
+    g_assert_cmpfloat(cfg2.buckets[THROTTLE_BPS_READ].level, <=, 8000);
+
+    throttle_group_unregister_tgm(tgm);
+    blk_unref(blk);
+    object_unparent(group);
+}
+
 int main(int argc, char **argv)
 {
     qemu_init_main_loop(&error_fatal);
@@ -830,6 +908,7 @@ int main(int argc, char **argv)
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
     g_test_add_func("/throttle/groups",             test_groups);
+    g_test_add_func("/throttle/group_cache",        test_group_cache);
     return g_test_run();
 }
 
@@ -385,6 +385,11 @@ aio_ctx_finalize(GSource     *source)
         luring_cleanup(ctx->linux_io_uring);
         ctx->linux_io_uring = NULL;
     }
+    if (ctx->linux_io_uring_cmd) {
+        luring_detach_aio_context(ctx->linux_io_uring_cmd, ctx);
+        luring_cleanup(ctx->linux_io_uring_cmd);
+        ctx->linux_io_uring_cmd = NULL;
+    }
 #endif
 
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
@@ -469,7 +474,7 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(ctx->io_uring_sqpoll, false, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -483,8 +488,44 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
     assert(ctx->linux_io_uring);
     return ctx->linux_io_uring;
 }
+
+LuringState *aio_setup_linux_io_uring_cmd(AioContext *ctx, Error **errp)
+{
+    if (ctx->linux_io_uring_cmd) {
+        return ctx->linux_io_uring_cmd;
+    }
+
+    ctx->linux_io_uring_cmd = luring_init(ctx->io_uring_sqpoll, true, errp);
+    if (!ctx->linux_io_uring_cmd) {
+        return NULL;
+    }
+
+    luring_attach_aio_context(ctx->linux_io_uring_cmd, ctx);
+    return ctx->linux_io_uring_cmd;
+}
+
+LuringState *aio_get_linux_io_uring_cmd(AioContext *ctx)
+{
+    assert(ctx->linux_io_uring_cmd);
+    return ctx->linux_io_uring_cmd;
+}
 #endif
 
+bool aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if ((ctx->linux_io_uring || ctx->linux_io_uring_cmd) &&
+        sqpoll != ctx->io_uring_sqpoll) {
+        error_setg(errp, "io-uring-sqpoll cannot be changed after the "
+                   "io_uring of the iothread has been set up");
+        return false;
+    }
+#endif
+    ctx->io_uring_sqpoll = sqpoll;
+    return true;
+}
+
 void aio_notify(AioContext *ctx)
 {
     /*
@@ -603,6 +644,7 @@ AioContext *aio_context_new(Error **errp)
 
 #ifdef CONFIG_LINUX_IO_URING
     ctx->linux_io_uring = NULL;
+    ctx->linux_io_uring_cmd = NULL;
 #endif
 
     ctx->thread_pool = NULL;
@@ -614,6 +656,7 @@ AioContext *aio_context_new(Error **errp)
     ctx->poll_shrink = 0;
 
     ctx->aio_max_batch = 0;
+    ctx->io_uring_sqpoll = false;
 
     ctx->thread_pool_min = 0;
     ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
@@ -50,8 +50,21 @@
  * extremely sparse, this is also O(m + m/W + m/W^2 + ...), so the amortized
  * cost of advancing from one bit to the next is usually constant (worst case
  * O(logB n) as in the non-amortized complexity).
+ *
+ * The last level accounts for almost all of the memory used by an HBitmap.
+ * Sparse HBitmaps (see hbitmap_alloc_sparse) therefore split it into chunks
+ * of HBITMAP_CHUNK_WORDS words which are only allocated while they contain
+ * set bits.  A chunk is in use iff any of the corresponding bits in the
+ * 2nd-last level is set, so the upper levels still steer iteration without
+ * ever touching an unallocated chunk.
  */
 
+#define HBITMAP_CHUNK_SHIFT 8
+#define HBITMAP_CHUNK_WORDS (1UL << HBITMAP_CHUNK_SHIFT)
+
+/* A chunk must map to whole words of the 2nd-last level */
+QEMU_BUILD_BUG_ON(HBITMAP_CHUNK_WORDS % BITS_PER_LONG);
+
 struct HBitmap {
     /*
      * Size of the bitmap, as requested in hbitmap_alloc or in hbitmap_truncate.
@@ -99,8 +112,85 @@ struct HBitmap {
 
     /* The length of each levels[] array. */
     uint64_t sizes[HBITMAP_LEVELS];
+
+    /*
+     * For sparse bitmaps, the chunks of the last level (which then has
+     * levels[HBITMAP_LEVELS - 1] == NULL); unused chunks are NULL.
+     */
+    unsigned long **chunks;
+    uint64_t nb_chunks;
 };
 
+/* Return word @pos of level @level, which reads as zero if not allocated */
+static inline unsigned long hb_word(const HBitmap *hb, int level, uint64_t pos)
+{
+    const unsigned long *chunk;
+
+    if (level != HBITMAP_LEVELS - 1 || !hb->chunks) {
+        return hb->levels[level][pos];
+    }
+
+    chunk = hb->chunks[pos >> HBITMAP_CHUNK_SHIFT];
+    return chunk ? chunk[pos & (HBITMAP_CHUNK_WORDS - 1)] : 0;
+}
+
+/*
+ * Return a pointer to word @pos of level @level.  If the word is in a chunk
+ * that is not allocated, allocate it if @alloc is true, or return NULL.
+ */
+static unsigned long *hb_word_ptr(HBitmap *hb, int level, uint64_t pos,
+                                  bool alloc)
+{
+    unsigned long **chunk;
+
+    if (level != HBITMAP_LEVELS - 1 || !hb->chunks) {
+        return &hb->levels[level][pos];
+    }
+
+    chunk = &hb->chunks[pos >> HBITMAP_CHUNK_SHIFT];
+    if (!*chunk) {
+        if (!alloc) {
+            return NULL;
+        }
+        *chunk = g_new0(unsigned long, HBITMAP_CHUNK_WORDS);
+    }
+    return &(*chunk)[pos & (HBITMAP_CHUNK_WORDS - 1)];
+}
+
+/*
+ * Free the chunks of a sparse bitmap that cover words @first..@last of the
+ * last level and have no bits set anymore.  The upper levels must be up to
+ * date.
+ */
+static void hb_free_unused_chunks(HBitmap *hb, uint64_t first, uint64_t last)
+{
+    const unsigned long *upper = hb->levels[HBITMAP_LEVELS - 2];
+    uint64_t upper_size = hb->sizes[HBITMAP_LEVELS - 2];
+    uint64_t i, j;
+
+    if (!hb->chunks) {
+        return;
+    }
+
+    for (i = first >> HBITMAP_CHUNK_SHIFT;
+         i <= (last >> HBITMAP_CHUNK_SHIFT); i++) {
+        uint64_t start = (i << HBITMAP_CHUNK_SHIFT) >> BITS_PER_LEVEL;
+        uint64_t end = MIN(start + (HBITMAP_CHUNK_WORDS >> BITS_PER_LEVEL),
+                           upper_size);
+
+        if (!hb->chunks[i]) {
+            continue;
+        }
+        for (j = start; j < end && !upper[j]; j++) {
+            /* nothing */
+        }
+        if (j == end) {
+            g_free(hb->chunks[i]);
+            hb->chunks[i] = NULL;
+        }
+    }
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -136,7 +226,7 @@ static unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
         hbi->cur[i] = cur & (cur - 1);
 
         /* Set up next level for iteration.  */
-        cur = hb->levels[i + 1][pos];
+        cur = hb_word(hb, i + 1, pos);
     }
 
     hbi->pos = pos;
@@ -149,7 +239,7 @@ static unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
 int64_t hbitmap_iter_next(HBitmapIter *hbi)
 {
     unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1] &
-            hbi->hb->levels[HBITMAP_LEVELS - 1][hbi->pos];
+            hb_word(hbi->hb, HBITMAP_LEVELS - 1, hbi->pos);
     int64_t item;
 
     if (cur == 0) {
@@ -182,7 +272,7 @@ void hbitmap_iter_init(HBitmapIter *hbi, const HBitmap *hb, uint64_t first)
         pos >>= BITS_PER_LEVEL;
 
         /* Drop bits representing items before first.  */
-        hbi->cur[i] = hb->levels[i][pos] & ~((1UL << bit) - 1);
+        hbi->cur[i] = hb_word(hb, i, pos) & ~((1UL << bit) - 1);
 
         /* We have already added level i+1, so the lowest set bit has
          * been processed.  Clear it.
@@ -220,8 +310,7 @@ int64_t hbitmap_next_dirty(const HBitmap *hb, int64_t start, int64_t count)
 int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
 {
     size_t pos = (start >> hb->granularity) >> BITS_PER_LEVEL;
-    unsigned long *last_lev = hb->levels[HBITMAP_LEVELS - 1];
-    unsigned long cur = last_lev[pos];
+    unsigned long cur;
     unsigned start_bit_offset;
     uint64_t end_bit, sz;
     int64_t res;
@@ -240,6 +329,7 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     /* There may be some zero bits in @cur before @start. We are not interested
      * in them, let's set them.
      */
+    cur = hb_word(hb, HBITMAP_LEVELS - 1, pos);
     start_bit_offset = (start >> hb->granularity) & (BITS_PER_LONG - 1);
     cur |= (1UL << start_bit_offset) - 1;
     assert((start >> hb->granularity) < hb->size);
@@ -247,13 +337,14 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     if (cur == (unsigned long)-1) {
         do {
             pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
+        } while (pos < sz &&
+                 hb_word(hb, HBITMAP_LEVELS - 1, pos) == (unsigned long)-1);
 
         if (pos >= sz) {
             return -1;
         }
 
-        cur = last_lev[pos];
+        cur = hb_word(hb, HBITMAP_LEVELS - 1, pos);
     }
 
     res = (pos << BITS_PER_LEVEL) + ctol(cur);
@@ -439,18 +530,22 @@ static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
     i = pos;
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
-        changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
+        changed |= hb_set_elem(hb_word_ptr(hb, level, i, true),
+                               start, next - 1);
         for (;;) {
+            unsigned long *elem;
+
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] == 0);
-            hb->levels[level][i] = ~0UL;
+            elem = hb_word_ptr(hb, level, i, true);
+            changed |= (*elem == 0);
+            *elem = ~0UL;
         }
     }
-    changed |= hb_set_elem(&hb->levels[level][i], start, last);
+    changed |= hb_set_elem(hb_word_ptr(hb, level, i, true), start, last);
 
     /* If there was any change in this layer, we may have to update
      * the one above.
@@ -486,6 +581,87 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
     }
 }
 
+#if HOST_LONG_BITS == 64
+/* Like hb_word_ptr(..., true), but safe against concurrent allocation */
+static unsigned long *hb_word_ptr_atomic(HBitmap *hb, int level, uint64_t pos)
+{
+    unsigned long **slot, *chunk, *old;
+
+    if (level != HBITMAP_LEVELS - 1 || !hb->chunks) {
+        return &hb->levels[level][pos];
+    }
+
+    slot = &hb->chunks[pos >> HBITMAP_CHUNK_SHIFT];
+    chunk = qatomic_read(slot);
+    if (!chunk) {
+        chunk = g_new0(unsigned long, HBITMAP_CHUNK_WORDS);
+        old = qatomic_cmpxchg(slot, NULL, chunk);
+        if (old) {
+            g_free(chunk);
+            chunk = old;
+        }
+    }
+    return &chunk[pos & (HBITMAP_CHUNK_WORDS - 1)];
+}
+
+/*
+ * Lock-free counterpart of hb_set_between().  Bits are only ever added, so
+ * a level only needs to be propagated upwards if one of its words went from
+ * zero to nonzero.  Returns the number of newly set bits.
+ */
+static uint64_t hb_set_between_atomic(HBitmap *hb, int level, uint64_t start,
+                                      uint64_t last)
+{
+    size_t pos = start >> BITS_PER_LEVEL;
+    size_t lastpos = last >> BITS_PER_LEVEL;
+    bool propagate = false;
+    uint64_t newly_set = 0;
+    size_t i;
+
+    for (i = pos; i <= lastpos; i++) {
+        uint64_t first_bit = MAX(start, (uint64_t)i << BITS_PER_LEVEL);
+        uint64_t last_bit = MIN(last, ((uint64_t)i << BITS_PER_LEVEL) |
+                                      (BITS_PER_LONG - 1));
+        unsigned long mask, old;
+
+        mask = 2UL << (last_bit & (BITS_PER_LONG - 1));
+        mask -= 1UL << (first_bit & (BITS_PER_LONG - 1));
+        old = qatomic_fetch_or(hb_word_ptr_atomic(hb, level, i), mask);
+
+        newly_set += ctpopl(mask & ~old);
+        propagate |= (old == 0);
+    }
+
+    if (level > 0 && propagate) {
+        hb_set_between_atomic(hb, level - 1, pos, lastpos);
+    }
+    return newly_set;
+}
+
+void hbitmap_set_atomic(HBitmap *hb, uint64_t start, uint64_t count)
+{
+    uint64_t first, last = start + count - 1;
+    uint64_t newly_set;
+
+    if (count == 0) {
+        return;
+    }
+
+    trace_hbitmap_set(hb, start, count,
+                      start >> hb->granularity, last >> hb->granularity);
+
+    first = start >> hb->granularity;
+    last >>= hb->granularity;
+    assert(last < hb->size);
+    assert(!hb->meta);
+
+    newly_set = hb_set_between_atomic(hb, HBITMAP_LEVELS - 1, first, last);
+    if (newly_set) {
+        qatomic_add(&hb->count, newly_set);
+    }
+}
+#endif
+
 /* Resetting works the other way round: propagate up if the new
  * value is zero.
  */
@@ -497,6 +673,11 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
     assert((last >> BITS_PER_LEVEL) == (start >> BITS_PER_LEVEL));
     assert(start <= last);
 
+    /* An unallocated chunk of a sparse bitmap is all zeroes */
+    if (!elem) {
+        return false;
+    }
+
     mask = 2UL << (last & (BITS_PER_LONG - 1));
     mask -= 1UL << (start & (BITS_PER_LONG - 1));
     blanked = *elem != 0 && ((*elem & ~mask) == 0);
@@ -523,25 +704,31 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
          * unless the lower-level word became entirely zero.  So, remove pos
          * from the upper-level range if bits remain set.
          */
-        if (hb_reset_elem(&hb->levels[level][i], start, next - 1)) {
+        if (hb_reset_elem(hb_word_ptr(hb, level, i, false),
+                          start, next - 1)) {
             changed = true;
         } else {
             pos++;
         }
 
         for (;;) {
+            unsigned long *elem;
+
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
+            elem = hb_word_ptr(hb, level, i, false);
+            if (elem) {
+                changed |= (*elem != 0);
+                *elem = 0UL;
+            }
         }
     }
 
     /* Same as above, this time for lastpos.  */
-    if (hb_reset_elem(&hb->levels[level][i], start, last)) {
+    if (hb_reset_elem(hb_word_ptr(hb, level, i, false), start, last)) {
         changed = true;
     } else {
         lastpos--;
@@ -577,9 +764,12 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
     assert(last < hb->size);
 
     hb->count -= hb_count_between(hb, first, last);
-    if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last) &&
-        hb->meta) {
-        hbitmap_set(hb->meta, start, count);
+    if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last)) {
+        hb_free_unused_chunks(hb, first >> BITS_PER_LEVEL,
+                              last >> BITS_PER_LEVEL);
+        if (hb->meta) {
+            hbitmap_set(hb->meta, start, count);
+        }
     }
 }
 
@@ -589,7 +779,17 @@ void hbitmap_reset_all(HBitmap *hb)
 
     /* Same as hbitmap_alloc() except for memset() instead of malloc() */
     for (i = HBITMAP_LEVELS; --i >= 1; ) {
-        memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
+        if (hb->levels[i]) {
+            memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
+        }
+    }
+    if (hb->chunks) {
+        uint64_t j;
+
+        for (j = 0; j < hb->nb_chunks; j++) {
+            g_free(hb->chunks[j]);
+            hb->chunks[j] = NULL;
+        }
     }
 
     hb->levels[0][0] = 1UL << (BITS_PER_LONG - 1);
@@ -621,7 +821,7 @@ bool hbitmap_get(const HBitmap *hb, uint64_t item)
     unsigned long bit = 1UL << (pos & (BITS_PER_LONG - 1));
     assert(pos < hb->size);
 
-    return (hb->levels[HBITMAP_LEVELS - 1][pos >> BITS_PER_LEVEL] & bit) != 0;
+    return (hb_word(hb, HBITMAP_LEVELS - 1, pos >> BITS_PER_LEVEL) & bit) != 0;
 }
 
 uint64_t hbitmap_serialization_align(const HBitmap *hb)
@@ -638,7 +838,7 @@ uint64_t hbitmap_serialization_align(const HBitmap *hb)
  */
 static void serialization_chunk(const HBitmap *hb,
                                 uint64_t start, uint64_t count,
-                                unsigned long **first_el, uint64_t *el_count)
+                                uint64_t *first_el, uint64_t *el_count)
 {
     uint64_t last = start + count - 1;
     uint64_t gran = hbitmap_serialization_align(hb);
@@ -652,7 +852,7 @@ static void serialization_chunk(const HBitmap *hb,
     start = (start >> hb->granularity) >> BITS_PER_LEVEL;
     last = (last >> hb->granularity) >> BITS_PER_LEVEL;
 
-    *first_el = &hb->levels[HBITMAP_LEVELS - 1][start];
+    *first_el = start;
     *el_count = last - start + 1;
 }
 
@@ -660,7 +860,7 @@ uint64_t hbitmap_serialization_size(const HBitmap *hb,
                                     uint64_t start, uint64_t count)
 {
     uint64_t el_count;
-    unsigned long *cur;
+    uint64_t cur;
 
     if (!count) {
         return 0;
@@ -674,7 +874,7 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
                             uint64_t start, uint64_t count)
 {
     uint64_t el_count;
-    unsigned long *cur, *end;
+    uint64_t cur, end;
 
     if (!count) {
         return;
@@ -683,8 +883,9 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
     end = cur + el_count;
 
     while (cur != end) {
-        unsigned long el =
-            (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
+        unsigned long el = hb_word(hb, HBITMAP_LEVELS - 1, cur);
+
+        el = (BITS_PER_LONG == 32 ? cpu_to_le32(el) : cpu_to_le64(el));
 
         memcpy(buf, &el, sizeof(el));
         buf += sizeof(el);
@@ -697,7 +898,7 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
                               bool finish)
 {
     uint64_t el_count;
-    unsigned long *cur, *end;
+    uint64_t cur, end;
 
     if (!count) {
         return;
@@ -706,12 +907,15 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     end = cur + el_count;
 
     while (cur != end) {
-        memcpy(cur, buf, sizeof(*cur));
+        unsigned long el;
+        unsigned long *p;
 
-        if (BITS_PER_LONG == 32) {
-            le32_to_cpus((uint32_t *)cur);
-        } else {
-            le64_to_cpus((uint64_t *)cur);
+        memcpy(&el, buf, sizeof(el));
+        el = (BITS_PER_LONG == 32 ? le32_to_cpu(el) : le64_to_cpu(el));
+
+        p = hb_word_ptr(hb, HBITMAP_LEVELS - 1, cur, el != 0);
+        if (p) {
+            *p = el;
         }
 
         buf += sizeof(unsigned long);
@@ -722,18 +926,39 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     }
 }
 
+/* Fill words @first..@first+@count-1 of the last level with 0 or ~0UL */
+static void hb_fill_words(HBitmap *hb, uint64_t first, uint64_t count,
+                          bool ones)
+{
+    uint64_t i;
+
+    if (!hb->chunks) {
+        memset(&hb->levels[HBITMAP_LEVELS - 1][first], ones ? 0xff : 0,
+               count * sizeof(unsigned long));
+        return;
+    }
+
+    for (i = first; i < first + count; i++) {
+        unsigned long *p = hb_word_ptr(hb, HBITMAP_LEVELS - 1, i, ones);
+
+        if (p) {
+            *p = ones ? ~0UL : 0;
+        }
+    }
+}
+
 void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
                                 bool finish)
 {
     uint64_t el_count;
-    unsigned long *first;
+    uint64_t first;
 
     if (!count) {
         return;
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0, el_count * sizeof(unsigned long));
+    hb_fill_words(hb, first, el_count, false);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -743,14 +968,14 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
                               bool finish)
 {
     uint64_t el_count;
-    unsigned long *first;
+    uint64_t first;
 
     if (!count) {
         return;
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0xff, el_count * sizeof(unsigned long));
+    hb_fill_words(hb, first, el_count, true);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -770,7 +995,7 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
         memset(bitmap->levels[lev], 0, size * sizeof(unsigned long));
 
         for (i = 0; i < prev_size; ++i) {
-            if (bitmap->levels[lev + 1][i]) {
+            if (hb_word(bitmap, lev + 1, i)) {
                 bitmap->levels[lev][i >> BITS_PER_LEVEL] |=
                     1UL << (i & (BITS_PER_LONG - 1));
             }
@@ -779,6 +1004,7 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
 
     bitmap->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
     bitmap->count = hb_count_between(bitmap, 0, bitmap->size - 1);
+    hb_free_unused_chunks(bitmap, 0, bitmap->sizes[HBITMAP_LEVELS - 1] - 1);
 }
 
 void hbitmap_free(HBitmap *hb)
@@ -788,10 +1014,18 @@ void hbitmap_free(HBitmap *hb)
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         g_free(hb->levels[i]);
     }
+    if (hb->chunks) {
+        uint64_t j;
+
+        for (j = 0; j < hb->nb_chunks; j++) {
+            g_free(hb->chunks[j]);
+        }
+        g_free(hb->chunks);
+    }
     g_free(hb);
 }
 
-HBitmap *hbitmap_alloc(uint64_t size, int granularity)
+static HBitmap *hbitmap_do_alloc(uint64_t size, int granularity, bool sparse)
 {
     HBitmap *hb = g_new0(struct HBitmap, 1);
     unsigned i;
@@ -808,7 +1042,12 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
         hb->sizes[i] = size;
-        hb->levels[i] = g_new0(unsigned long, size);
+        if (sparse && i == HBITMAP_LEVELS - 1) {
+            hb->nb_chunks = DIV_ROUND_UP(size, HBITMAP_CHUNK_WORDS);
+            hb->chunks = g_new0(unsigned long *, hb->nb_chunks);
+        } else {
+            hb->levels[i] = g_new0(unsigned long, size);
+        }
     }
 
     /* We necessarily have free bits in level 0 due to the definition
@@ -820,6 +1059,21 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     return hb;
 }
 
+HBitmap *hbitmap_alloc(uint64_t size, int granularity)
+{
+    return hbitmap_do_alloc(size, granularity, false);
+}
+
+HBitmap *hbitmap_alloc_sparse(uint64_t size, int granularity)
+{
+    return hbitmap_do_alloc(size, granularity, true);
+}
+
+bool hbitmap_is_sparse(const HBitmap *hb)
+{
+    return hb->chunks != NULL;
+}
+
 void hbitmap_truncate(HBitmap *hb, uint64_t size)
 {
     bool shrink;
@@ -862,6 +1116,21 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
         }
         old = hb->sizes[i];
         hb->sizes[i] = size;
+        if (!hb->levels[i]) {
+            /* Last level of a sparse bitmap */
+            uint64_t nb_chunks = DIV_ROUND_UP(size, HBITMAP_CHUNK_WORDS);
+            uint64_t j;
+
+            for (j = nb_chunks; j < hb->nb_chunks; j++) {
+                g_free(hb->chunks[j]);
+            }
+            hb->chunks = g_renew(unsigned long *, hb->chunks, nb_chunks);
+            for (j = hb->nb_chunks; j < nb_chunks; j++) {
+                hb->chunks[j] = NULL;
+            }
+            hb->nb_chunks = nb_chunks;
+            continue;
+        }
         hb->levels[i] = g_renew(unsigned long, hb->levels[i], size);
         if (!shrink) {
             memset(&hb->levels[i][old], 0x00,
@@ -916,7 +1185,8 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
         return;
     }
 
-    if (a->granularity != b->granularity) {
+    if (a->granularity != b->granularity ||
+        a->chunks || b->chunks || result->chunks) {
         if ((a != result) && (b != result)) {
             hbitmap_reset_all(result);
         }
@@ -949,7 +1219,33 @@ char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
     size_t size = bitmap->sizes[HBITMAP_LEVELS - 1] * sizeof(unsigned long);
     char *data = (char *)bitmap->levels[HBITMAP_LEVELS - 1];
     char *hash = NULL;
-    qcrypto_hash_digest(QCRYPTO_HASH_ALGO_SHA256, data, size, &hash, errp);
+    g_autoptr(QCryptoHash) ctx = NULL;
+    g_autofree unsigned long *zeroes = NULL;
+    uint64_t i;
+
+    if (!bitmap->chunks) {
+        qcrypto_hash_digest(QCRYPTO_HASH_ALGO_SHA256, data, size, &hash, errp);
+        return hash;
+    }
+
+    /* Hash the same data as for a non-sparse bitmap */
+    ctx = qcrypto_hash_new(QCRYPTO_HASH_ALGO_SHA256, errp);
+    if (!ctx) {
+        return NULL;
+    }
+    zeroes = g_new0(unsigned long, HBITMAP_CHUNK_WORDS);
+    for (i = 0; i < bitmap->nb_chunks; i++) {
+        const unsigned long *chunk = bitmap->chunks[i] ?: zeroes;
+        size_t len = MIN(size, HBITMAP_CHUNK_WORDS * sizeof(unsigned long));
+
+        if (qcrypto_hash_update(ctx, (const char *)chunk, len, errp) < 0) {
+            return NULL;
+        }
+        size -= len;
+    }
+    if (qcrypto_hash_finalize_digest(ctx, &hash, errp) < 0) {
+        return NULL;
+    }
 
     return hash;
 }
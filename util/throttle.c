@@ -462,6 +462,40 @@ bool throttle_schedule_timer(ThrottleState *ts,
     return true;
 }
 
+/*
+ * Check whether an I/O request would have to wait, without arming a timer
+ *
+ * @clock_type: the clock used by @ts
+ * @direction:  throttle direction
+ * @ret:        true if the next request in @direction has to wait
+ */
+bool throttle_would_wait(ThrottleState *ts, QEMUClockType clock_type,
+                         ThrottleDirection direction)
+{
+    int64_t next_timestamp;
+
+    assert(direction < THROTTLE_MAX);
+    return throttle_compute_timer(ts, direction,
+                                  qemu_clock_get_ns(clock_type),
+                                  &next_timestamp);
+}
+
+/*
+ * compute how many operations an I/O request of a given size counts as
+ *
+ * @op_size:  the size of an operation in bytes, or 0
+ * @size:     the size of the I/O request
+ * @ret:      the number of operations
+ */
+double throttle_op_units(uint64_t op_size, uint64_t size)
+{
+    /* if op_size is defined and smaller than size we compute unit count */
+    if (op_size && size > op_size) {
+        return (double) size / op_size;
+    }
+    return 1.0;
+}
+
 /* do the accounting for this operation
  *
  * @direction: throttle direction
@@ -469,6 +503,20 @@ bool throttle_schedule_timer(ThrottleState *ts,
  */
 void throttle_account(ThrottleState *ts, ThrottleDirection direction,
                       uint64_t size)
+{
+    throttle_account_units(ts, direction, size,
+                           throttle_op_units(ts->cfg.op_size, size));
+}
+
+/*
+ * do the accounting for a number of bytes and operations at once
+ *
+ * @direction: throttle direction
+ * @size:     the number of bytes
+ * @units:    the number of operations
+ */
+void throttle_account_units(ThrottleState *ts, ThrottleDirection direction,
+                            uint64_t size, double units)
 {
     static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
         { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
@@ -478,14 +526,9 @@ void throttle_account(ThrottleState *ts, ThrottleDirection direction,
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
     };
-    double units = 1.0;
     unsigned i;
 
     assert(direction < THROTTLE_MAX);
-    /* if cfg.op_size is defined and smaller than size we compute unit count */
-    if (ts->cfg.op_size && size > ts->cfg.op_size) {
-        units = (double) size / ts->cfg.op_size;
-    }
 
     for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
         LeakyBucket *bkt;
@@ -52,6 +52,16 @@
  * possible by QIOChannel's support for spurious coroutine re-entry in
  * qio_channel_yield(). The coroutine will restart I/O when re-entered from the
  * new AioContext.
+ *
+ * Virtqueues can be assigned to other AioContexts with the vq_aio_context
+ * argument of vhost_user_server_start(). Their kick fds are then monitored in
+ * that AioContext. vu_client_trip() briefly moves to the virtqueue's
+ * AioContext to add or remove a kick fd handler so that the handler cannot be
+ * running in another thread at the same time. libvhost-user is not
+ * thread-safe, so virtqueue processing is paused and in-flight requests are
+ * waited for while handling any vhost-user message that may change memory
+ * mappings, the dirty log, or device or virtqueue state (see
+ * vmsg_changes_state()), and before vu_deinit() when the connection ends.
  */
 
 static void vmsg_close_fds(VhostUserMsg *vmsg)
@@ -82,6 +92,26 @@ static void vmsg_unblock_fds(VhostUserMsg *vmsg)
     }
 }
 
+/*
+ * Returns whether handling @vmsg may change guest memory mappings, the dirty
+ * log, or device or virtqueue state, which the iothreads of the virtqueues
+ * access without locking.  Only pure queries are safe to handle while the
+ * virtqueues keep running.
+ */
+static bool vmsg_changes_state(VhostUserMsg *vmsg)
+{
+    switch (vmsg->request) {
+    case VHOST_USER_GET_FEATURES:
+    case VHOST_USER_GET_PROTOCOL_FEATURES:
+    case VHOST_USER_GET_QUEUE_NUM:
+    case VHOST_USER_GET_CONFIG:
+    case VHOST_USER_GET_MAX_MEM_SLOTS:
+        return false;
+    default:
+        return true;
+    }
+}
+
 static void panic_cb(VuDev *vu_dev, const char *buf)
 {
     error_report("vu_panic: %s", buf);
@@ -89,14 +119,19 @@ static void panic_cb(VuDev *vu_dev, const char *buf)
 
 void vhost_user_server_inc_in_flight(VuServer *server)
 {
-    assert(!server->wait_idle);
+    assert(!qatomic_read(&server->wait_idle));
     qatomic_inc(&server->in_flight);
 }
 
+/* May be called from the iothread of any virtqueue */
 void vhost_user_server_dec_in_flight(VuServer *server)
 {
+    /*
+     * qatomic_fetch_dec() is a full barrier and pairs with smp_mb() in
+     * vu_wait_idle().  Whoever clears wait_idle is responsible for the wake.
+     */
     if (qatomic_fetch_dec(&server->in_flight) == 1) {
-        if (server->wait_idle) {
+        if (qatomic_xchg(&server->wait_idle, false)) {
             aio_co_wake(server->co_trip);
         }
     }
@@ -107,6 +142,27 @@ bool vhost_user_server_has_in_flight(VuServer *server)
     return qatomic_load_acquire(&server->in_flight) > 0;
 }
 
+/*
+ * Wait until no requests are in flight.  The last request may complete in
+ * another thread at any time, so announce the wait before checking in_flight
+ * again.  A wake that arrives before the coroutine has yielded is scheduled
+ * and only enters the coroutine once it yields.
+ */
+static void coroutine_fn vu_wait_idle(VuServer *server)
+{
+    while (vhost_user_server_has_in_flight(server)) {
+        qatomic_set(&server->wait_idle, true);
+        smp_mb(); /* pairs with qatomic_fetch_dec() in dec_in_flight() */
+        if (vhost_user_server_has_in_flight(server) ||
+            !qatomic_xchg(&server->wait_idle, false)) {
+            /* vhost_user_server_dec_in_flight() wakes us up */
+            qemu_coroutine_yield();
+        }
+    }
+}
+
+static void coroutine_fn vu_pause_vqs(VuServer *server);
+
 static bool coroutine_fn
 vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
 {
@@ -199,6 +255,10 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
         }
     }
 
+    if (server->vq_aio_context && vmsg_changes_state(vmsg)) {
+        vu_pause_vqs(server);
+    }
+
     return true;
 
 fail:
@@ -207,10 +267,13 @@ fail:
     return false;
 }
 
+static void coroutine_fn vu_resume_vqs(VuServer *server);
+
 static coroutine_fn void vu_client_trip(void *opaque)
 {
     VuServer *server = opaque;
     VuDev *vu_dev = &server->vu_dev;
+    bool ok;
 
     while (!vu_dev->broken) {
         if (server->quiescing) {
@@ -218,18 +281,23 @@ static coroutine_fn void vu_client_trip(void *opaque)
             aio_wait_kick();
             return;
         }
+
+        ok = vu_dispatch(vu_dev);
+        if (server->vqs_paused) {
+            vu_resume_vqs(server);
+        }
+
         /* vu_dispatch() returns false if server->ctx went away */
-        if (!vu_dispatch(vu_dev) && server->ctx) {
+        if (!ok && server->ctx) {
             break;
         }
     }
 
-    if (vhost_user_server_has_in_flight(server)) {
-        /* Wait for requests to complete before we can unmap the memory */
-        server->wait_idle = true;
-        qemu_coroutine_yield();
-        server->wait_idle = false;
-    }
+    /*
+     * Stop the kick fd handlers, which may run in other AioContexts, and wait
+     * for requests to complete before we can unmap the memory
+     */
+    vu_pause_vqs(server);
     assert(!vhost_user_server_has_in_flight(server));
 
     vu_deinit(vu_dev);
@@ -272,6 +340,83 @@ static void kick_handler(void *opaque)
     }
 }
 
+/* Returns false while kick fd handlers must stay removed */
+static bool vu_fd_watches_enabled(VuServer *server)
+{
+    return !server->vqs_paused && !server->quiescing && !server->stopping;
+}
+
+/*
+ * Add or remove the kick fd handler. Coroutines move to the AioContext of the
+ * handler for this so that it is not running concurrently in another thread
+ * when the caller goes on to free @vu_fd_watch.
+ */
+static void coroutine_mixed_fn
+vu_fd_watch_set_enabled(VuServer *server, VuFdWatch *vu_fd_watch, bool enabled)
+{
+    AioContext *ctx = vu_fd_watch->ctx ?: server->ctx;
+    AioContext *home_ctx = qemu_get_current_aio_context();
+    IOHandler *handler = enabled ? kick_handler : NULL;
+
+    if (qemu_in_coroutine() && ctx != home_ctx) {
+        aio_co_reschedule_self(ctx);
+        aio_set_fd_handler(ctx, vu_fd_watch->fd, handler, NULL, NULL, NULL,
+                           vu_fd_watch);
+        aio_co_reschedule_self(home_ctx);
+    } else {
+        aio_set_fd_handler(ctx, vu_fd_watch->fd, handler, NULL, NULL, NULL,
+                           vu_fd_watch);
+    }
+}
+
+static void coroutine_fn vu_pause_vqs(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    /* Detaching or stopping the server has removed them already */
+    if (server->ctx && vu_fd_watches_enabled(server)) {
+        QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+            vu_fd_watch_set_enabled(server, vu_fd_watch, false);
+        }
+    }
+    server->vqs_paused = true;
+
+    /* In-flight requests still access guest memory */
+    vu_wait_idle(server);
+}
+
+static void coroutine_fn vu_resume_vqs(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    server->vqs_paused = false;
+    if (!vu_fd_watches_enabled(server)) {
+        /* vhost_user_server_attach_aio_context() will add them back */
+        return;
+    }
+
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        vu_fd_watch_set_enabled(server, vu_fd_watch, true);
+    }
+}
+
+/* Returns the AioContext that @fd is assigned to, or NULL for server->ctx */
+static AioContext *vu_kick_fd_aio_context(VuServer *server, int fd)
+{
+    VuDev *vu_dev = &server->vu_dev;
+
+    if (!server->vq_aio_context) {
+        return NULL;
+    }
+
+    for (int i = 0; i < vu_dev->max_queues; i++) {
+        if (vu_dev->vq[i].kick_fd == fd) {
+            return server->vq_aio_context[i];
+        }
+    }
+    return NULL;
+}
+
 static VuFdWatch *find_vu_fd_watch(VuServer *server, int fd)
 {
 
@@ -303,11 +448,13 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
 
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
-        qemu_socket_set_nonblock(fd);
-        aio_set_fd_handler(server->ctx, fd, kick_handler,
-                           NULL, NULL, NULL, vu_fd_watch);
+        vu_fd_watch->ctx = vu_kick_fd_aio_context(server, fd);
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
+        qemu_socket_set_nonblock(fd);
+        if (vu_fd_watches_enabled(server)) {
+            vu_fd_watch_set_enabled(server, vu_fd_watch, true);
+        }
     }
 }
 
@@ -325,7 +472,7 @@ static void remove_watch(VuDev *vu_dev, int fd)
     if (!vu_fd_watch) {
         return;
     }
-    aio_set_fd_handler(server->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+    vu_fd_watch_set_enabled(server, vu_fd_watch, false);
 
     QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
     g_free(vu_fd_watch);
@@ -381,12 +528,13 @@ void vhost_user_server_stop(VuServer *server)
     qemu_bh_delete(server->restart_listener_bh);
     server->restart_listener_bh = NULL;
 
+    server->stopping = true;
+
     if (server->sioc) {
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            vu_fd_watch_set_enabled(server, vu_fd_watch, false);
         }
 
         qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
@@ -423,9 +571,11 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
         return;
     }
 
-    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-        aio_set_fd_handler(ctx, vu_fd_watch->fd, kick_handler, NULL,
-                           NULL, NULL, vu_fd_watch);
+    /* vu_resume_vqs() adds them back if virtqueues are paused */
+    if (!server->vqs_paused) {
+        QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+            vu_fd_watch_set_enabled(server, vu_fd_watch, true);
+        }
     }
 
     if (server->co_trip) {
@@ -456,8 +606,7 @@ void vhost_user_server_detach_aio_context(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            vu_fd_watch_set_enabled(server, vu_fd_watch, false);
         }
     }
 
@@ -474,6 +623,7 @@ void vhost_user_server_detach_aio_context(VuServer *server)
 bool vhost_user_server_start(VuServer *server,
                              SocketAddress *socket_addr,
                              AioContext *ctx,
+                             AioContext **vq_aio_context,
                              uint16_t max_queues,
                              const VuDevIface *vu_iface,
                              Error **errp)
@@ -503,6 +653,7 @@ bool vhost_user_server_start(VuServer *server,
         .vu_iface              = vu_iface,
         .max_queues            = max_queues,
         .ctx                   = ctx,
+        .vq_aio_context        = vq_aio_context,
     };
 
     qio_net_listener_set_name(server->listener, "vhost-user-backend-listener");